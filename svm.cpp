@@ -7,6 +7,8 @@
 #include <list>
 #include <stack>
 
+#include "svm_mnemonics.hh"
+
 using namespace std;
 
 class Token {
@@ -54,6 +56,14 @@ std::ostream& operator << ( std::ostream& outs, const Token* tok ) {
   return outs << *tok;
 }
 
+// JMP_LT todavia no tiene mnemonico
+static constexpr Mnemonic<Token::KeywordType> mnemonics[] = {
+  {"push", Token::PUSH}, {"pop", Token::POP}, {"dup", Token::DUP},
+  {"add", Token::ADD}, {"sub", Token::SUB}, {"mult", Token::MULT},
+  {"div", Token::DIV}, {"pow", Token::POW}, {"goto", Token::GOTO}
+};
+static constexpr MnemonicTable reserved(mnemonics, Token::NOTHING);
+
 Scanner::Scanner(const char* s):input(s),first(0), current(0) { }
 Scanner::Scanner(const string s):input(s),first(0), current(0) { }
 
@@ -80,21 +90,7 @@ Token* Scanner::nextToken() {
       current++;
     } else {
       // check if it's an instruction
-      string s = input.substr(first,current-first);
-      Token::KeywordType ktype;     
-      // Token::KeywordType ktype = Scanner::checkReserved(text);
-      // NOTHING, PUSH, POP, ADD, SUB, MULT, DIV, POW, GOTO, JMP_LT };
-      if (!s.compare("push")) ktype = Token::PUSH;
-      else if (!s.compare("pop")) ktype = Token::POP;
-      else if (!s.compare("dup")) ktype = Token::DUP;
-      else if (!s.compare("add")) ktype = Token::ADD;
-      else if (!s.compare("sub")) ktype = Token::SUB;
-      else if (!s.compare("mult")) ktype = Token::MULT;
-      else if (!s.compare("div")) ktype = Token::DIV;
-      else if (!s.compare("pow")) ktype = Token::POW;
-      else if (!s.compare("goto")) ktype = Token::GOTO;
-      else if (!s.compare("add")) ktype = Token::JMP_LT;
-      else ktype = Token::NOTHING;
+      Token::KeywordType ktype = reserved.find(string_view(input).substr(first,current-first));
       
       if (ktype != Token::NOTHING) {
 	token = new Token(Token::KEYWORD,input,first,current-first);
@@ -0,0 +1,102 @@
+#ifndef SVM_MNEMONICS
+#define SVM_MNEMONICS
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+
+// Tabla de mnemonicos con un hash perfecto que se calcula al compilar. La
+// clave de una palabra es su largo, su primer caracter y sus dos ultimos
+// (asi se separan jmpgt, jmpge y jmplt). El constructor busca un
+// multiplicador que mande cada mnemonico a una casilla distinta, de modo que
+// buscar una palabra cuesta una multiplicacion y una comparacion. Cada
+// scanner arma la tabla con su propio enum de tokens:
+//
+//   static constexpr Mnemonic<Token::Type> names[] = { {"push", Token::PUSH}, ... };
+//   static constexpr MnemonicTable reserved(names, Token::ERR);
+//   Token::Type t = reserved.find(lexema);  // Token::ERR si no es mnemonico
+//
+// Si dos mnemonicos tienen la misma clave la tabla no compila.
+template <typename T>
+struct Mnemonic {
+  const char* name;
+  T value;
+};
+
+template <typename T, size_t N>
+class MnemonicTable {
+public:
+  static const int BITS = 6;
+  static const int SLOTS = 1 << BITS;
+  static const size_t MAXLEN = 15;
+  static_assert(N <= SLOTS / 2, "demasiados mnemonicos para la tabla");
+
+  constexpr MnemonicTable(const Mnemonic<T> (&names)[N], T none):none(none) {
+    uint32_t keys[N] = {};
+    for (size_t i=0; i < N; i++) {
+      size_t n = length(names[i].name);
+      if (n < 2 || n > MAXLEN) throw "mnemonico de largo invalido";
+      keys[i] = key(names[i].name, n);
+      for (size_t j=0; j < i; j++)
+	if (keys[j] == keys[i]) throw "dos mnemonicos con la misma clave";
+    }
+    seed = findSeed(keys);
+    for (size_t i=0; i < N; i++) {
+      Slot& s = slots[slot(keys[i], seed)];
+      s.name = names[i].name;
+      s.len = length(names[i].name);
+      s.value = names[i].value;
+    }
+  }
+
+  constexpr T find(string_view s) const {
+    if (s.size() < 2 || s.size() > MAXLEN) return none;
+    const Slot& e = slots[slot(key(s.data(), s.size()), seed)];
+    if (e.len != s.size()) return none;
+    for (size_t i=0; i < e.len; i++)
+      if (e.name[i] != s[i]) return none;
+    return e.value;
+  }
+
+private:
+  struct Slot {
+    const char* name = "";
+    size_t len = 0; // 0: casilla libre
+    T value = T();
+  };
+  Slot slots[SLOTS] = {};
+  uint32_t seed = 0;
+  T none;
+
+  static constexpr size_t length(const char* s) {
+    size_t n = 0;
+    while (s[n] != 0) n++;
+    return n;
+  }
+
+  static constexpr uint32_t key(const char* s, size_t n) {
+    return (uint32_t) n | (uint32_t) (unsigned char) s[0] << 8
+      | (uint32_t) (unsigned char) s[n-2] << 16 | (uint32_t) (unsigned char) s[n-1] << 24;
+  }
+
+  static constexpr int slot(uint32_t key, uint32_t seed) {
+    return (uint32_t) (key * seed) >> (32 - BITS);
+  }
+
+  static constexpr uint32_t findSeed(const uint32_t (&keys)[N]) {
+    for (uint32_t seed = 0x9e3779b1u; seed != 0x9e3779b1u + 2 * 100000; seed += 2) {
+      bool used[SLOTS] = {};
+      size_t i = 0;
+      while (i < N && !used[slot(keys[i], seed)])
+	used[slot(keys[i++], seed)] = true;
+      if (i == N) return seed;
+    }
+    throw "no se encontro un hash perfecto";
+  }
+};
+
+
+#endif
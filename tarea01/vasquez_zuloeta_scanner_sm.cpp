@@ -3,12 +3,13 @@
 #include <stdlib.h>
 #include <cstring>
 #include <fstream>
-#include <unordered_map>
 #include <memory>
 
 #include <list>
 #include <stack>
 
+#include "../svm_mnemonics.hh"
+
 using namespace std;
 
 /*
@@ -17,8 +18,7 @@ using namespace std;
   Marcelo Zuloeta
 */
 
-// Estructura de datos utilizada: Unordered map --> <string, Token>
-// Tambien implementado una función hash para este map customizado
+// Estructura de datos utilizada: tabla con hash perfecto (svm_mnemonics.hh) --> <string, Token::Type>
 
 // Cambios:
 // Clase Token --> Enum type
@@ -36,33 +36,26 @@ public:
   Token(Type, const string source);
 };
 
-template <>
-struct hash<Token>
-{
-  size_t operator()(const Token &token) const
-  {
-    return static_cast<size_t>(token.type) ^ std::hash<std::string>()(token.lexema);
-  }
-};
-
-std::unordered_map<string, Token> keywords = {
-    {"push", Token(Token::PUSH)},
-    {"jmpeq", Token(Token::JMPEQ)},
-    {"jmpgt", Token(Token::JMPGT)},
-    {"jmpge", Token(Token::JMPGE)},
-    {"jmplt", Token(Token::JMPLT)},
-    {"jmple", Token(Token::JMPLE)},
-    {"goto", Token(Token::GOTO)},
-    {"skip", Token(Token::SKIP)},
-    {"pop", Token(Token::POP)},
-    {"dup", Token(Token::DUP)},
-    {"swap", Token(Token::SWAP)},
-    {"add", Token(Token::ADD)},
-    {"sub", Token(Token::SUB)},
-    {"mul", Token(Token::MUL)},
-    {"div", Token(Token::DIV)},
-    {"store", Token(Token::STORE)},
-    {"load", Token(Token::LOAD)}};
+constexpr Mnemonic<Token::Type> mnemonics[] = {
+    {"push", Token::PUSH},
+    {"jmpeq", Token::JMPEQ},
+    {"jmpgt", Token::JMPGT},
+    {"jmpge", Token::JMPGE},
+    {"jmplt", Token::JMPLT},
+    {"jmple", Token::JMPLE},
+    {"goto", Token::GOTO},
+    {"skip", Token::SKIP},
+    {"pop", Token::POP},
+    {"dup", Token::DUP},
+    {"swap", Token::SWAP},
+    {"add", Token::ADD},
+    {"sub", Token::SUB},
+    {"mul", Token::MUL},
+    {"div", Token::DIV},
+    {"store", Token::STORE},
+    {"load", Token::LOAD}};
+
+constexpr MnemonicTable keywords(mnemonics, Token::ERR);
 
 const char *Token::token_names[25] = {"NUM", "ID", "LABEL", "EOL", "PUSH", "JMPEQ", "JMPGT", "JMPGE", "JMPLT", "JMPLE", "GOTO", "SKIP", "POP", "DUP", "SWAP", "ADD", "SUB", "MUL", "DIV", "STORE", "LOAD", "ERR", "END"};
 
@@ -133,14 +126,16 @@ Token* Scanner::nextToken() {
         else if (c == ':') setState(3);
         else setState(2);
         break;
-      case 2:
-        if (keywords.find(getLexema().substr(0,getLexema().size()-1)) != keywords.end())
-          token = &(keywords.find(getLexema().substr(0, getLexema().size() - 1))->second);
+      case 2: {
+        Token::Type kw = keywords.find(string_view(input).substr(first, current - first - 1));
+        if (kw != Token::ERR)
+          token = new Token(kw);
         else
           token =  new Token(Token::ID, getLexema());
         rollBack();
         return token;
         break;
+      }
       case 3:
         return new Token(Token::LABEL, getLexema().substr(0, getLexema().size() - 1));
         break;
@@ -1,8 +1,14 @@
 #include <iostream>
+#include <thread>
+#include <algorithm>
+#include <string_view>
 
 #include "svm.hh"
+#include "svm_prof.hh"
+#include "svm_trace.hh"
 
-string snames[18] = { "push", "pop", "dup", "swap", "add", "sub", "mult", "div", "goto", "jmpeq", "jmpgt", "jmpge", "jmplt", "jmple", "skip", "store", "load", "print" };
+string snames[NUM_OPS] = { "push", "pop", "dup", "swap", "add", "sub", "mult", "div", "goto", "jmpeq", "jmpgt", "jmpge", "jmplt", "jmple", "skip", "store", "load", "print",
+			   "addi", "subi", "tee", "incr", "jmpeqri", "jmpgtri", "jmpgeri", "jmpltri", "jmpleri", "jmpeqi", "jmpgti", "jmpgei", "jmplti", "jmplei" };
 
 Instruction::Instruction(string l, IType itype):label(l),type(itype),hasarg(false) {
 }
@@ -14,43 +20,300 @@ Instruction::Instruction(string l, IType itype, string arg):label(l),type(itype)
 
 }
 
-SVM::SVM(list<Instruction*>& sl) {
+OpStack::OpStack(int cap):data(new int[cap]),sp(0),cap(cap) {
+}
+
+OpStack::~OpStack() {
+  delete [] data;
+}
+
+Program::Program(list<Instruction*>& sl):owner(false) {
   instructions.reserve(sl.size());
   copy(begin(sl), end(sl), back_inserter(instructions));
-  pc = 0;
-  // resolver labels
+  resolveLabels();
+  // codificar en el flujo compacto
+  code.resize(instructions.size());
   for(int i=0; i < instructions.size(); i++) {
-    string l = instructions[i]->label;
-    if (l != "")
-      labels[l] = i; 
+    code[i].op = instructions[i]->type;
+    code[i].reg = 0;
+    code[i].arg = instructions[i]->hasarg ? instructions[i]->argint : 0;
   }
-  for(int i=0; i < instructions.size(); i++) {
-    string jl = instructions[i]->jmplabel;
-    if (jl != "") {
-      std::unordered_map<std::string,int>::const_iterator it = labels.find(jl);
-      if (it == labels.end()) {
-	cout << "No se encontro label " << jl << endl;
-	exit(0);
-      } else
-	instructions[i]->argint = it->second;
+  verify();
+  fuse();
+}
+
+Program::~Program() {
+  if (owner)
+    for (int i=0; i < instructions.size(); i++)
+      delete instructions[i];
+}
+
+void parallelFor(int n, const function<void(int)>& f) {
+  vector<thread> threads;
+  for (int k=1; k < n; k++)
+    threads.push_back(thread(f, k));
+  f(0);
+  for (int k=0; k < threads.size(); k++)
+    threads[k].join();
+}
+
+// Instrucciones por hilo como minimo al resolver labels
+static const int LABEL_CHUNK = 1 << 17;
+
+struct LabelDef {
+  string_view name;
+  int pc;
+};
+
+// Los labels se resuelven en tres fases sobre t rangos de instrucciones y t
+// tablas, una por hilo: cada rango reparte sus definiciones entre las tablas
+// segun el hash del nombre; cada tabla se llena en orden de programa, asi
+// que el primer nombre que ya estaba es la primera redefinicion; y cada
+// rango busca los destinos de sus saltos. Los errores son los mismos con
+// cualquier t: el de la primera instruccion del programa que falla. Con
+// pocas instrucciones t es 1 y todo corre en el hilo actual.
+void Program::resolveLabels() {
+  int n = instructions.size();
+  int t = min(n / LABEL_CHUNK, (int) thread::hardware_concurrency());
+  if (t < 1) t = 1;
+  hash<string_view> h;
+  vector<vector<LabelDef> > defs(t * t); // defs[rango * t + tabla]
+  parallelFor(t, [&](int r) {
+    for (int i = (int64_t) n * r / t; i < (int64_t) n * (r+1) / t; i++) {
+      string_view l = instructions[i]->label;
+      if (!l.empty())
+	defs[r * t + h(l) % t].push_back(LabelDef{l, i});
+    }
+  });
+  vector<unordered_map<string_view,int> > tables(t);
+  vector<int> redefined(t, n);
+  parallelFor(t, [&](int s) {
+    size_t total = 0;
+    for (int r=0; r < t; r++) total += defs[r * t + s].size();
+    tables[s].reserve(total);
+    for (int r=0; r < t && redefined[s] == n; r++)
+      for (const LabelDef& d : defs[r * t + s])
+	if (!tables[s].insert(make_pair(d.name, d.pc)).second) {
+	  redefined[s] = d.pc;
+	  break;
+	}
+  });
+  int first = *min_element(redefined.begin(), redefined.end());
+  if (first < n)
+    throw SVMError("Label repetido " + instructions[first]->label);
+  vector<int> missing(t, n);
+  parallelFor(t, [&](int r) {
+    for (int i = (int64_t) n * r / t; i < (int64_t) n * (r+1) / t; i++) {
+      string_view jl = instructions[i]->jmplabel;
+      if (jl.empty()) continue;
+      const unordered_map<string_view,int>& table = tables[h(jl) % t];
+      unordered_map<string_view,int>::const_iterator it = table.find(jl);
+      if (it == table.end()) {
+	missing[r] = i;
+	break;
+      }
+      instructions[i]->argint = it->second;
+    }
+  });
+  first = *min_element(missing.begin(), missing.end());
+  if (first < n)
+    throw SVMError("No se encontro label " + instructions[first]->jmplabel);
+}
+
+// Tabla lateral de un programa cargado de una imagen
+void Program::side() const {
+  if (!owner) return;
+  call_once(sideonce, [this] {
+    int n = code.size();
+    const char* strings = imagestrings.data();
+    instructions.reserve(n);
+    for (int i=0; i < n; i++) {
+      const Code& c = code[i];
+      int32_t l = imagenames[2*i], jl = imagenames[2*i+1];
+      string label = l >= 0 ? strings + l : "";
+      Instruction* s;
+      if (isJump(c.op))
+	s = new Instruction(label, (Instruction::IType) c.op, jl >= 0 ? strings + jl : "?");
+      else if (c.op == Instruction::IPUSH || c.op == Instruction::ISTORE || c.op == Instruction::ILOAD)
+	s = new Instruction(label, (Instruction::IType) c.op, c.arg);
+      else
+	s = new Instruction(label, (Instruction::IType) c.op);
+      s->argint = c.arg;
+      instructions.push_back(s);
+    }
+  });
+}
+
+ExecutionContext::ExecutionContext(const Program& p, int maxdepth):prog(p),opstack(maxdepth) {
+  pc = 0;
+  trace = NULL;
+  out = &cout;
+  for (int r=0; r < 8; r++) registers[r] = 0;
+  if (prog.maxheight > opstack.capacity())
+    perror("Stack overflow: program needs " + to_string(prog.maxheight) +
+	   " stack slots (--stack-size)");
+}
+
+SVM::SVM(list<Instruction*>& sl, int maxdepth):ProgramOwner(new Program(sl)),ExecutionContext(*owned, maxdepth) {
+}
+
+SVM::SVM(Program* p, int maxdepth):ProgramOwner(p),ExecutionContext(*owned, maxdepth) {
+}
+
+/* ******** Verificador *********** */
+
+// Elementos que cada opcode necesita en la pila y como cambia su altura
+// (mismo orden que Instruction::IType)
+static const int op_needs[18] = { 0, 1, 1, 2, 2, 2, 2, 2, 0, 2, 2, 2, 2, 2, 0, 1, 0, 0 };
+static const int op_delta[18] = { 1, -1, 1, 0, -1, -1, -1, -1, 0, -2, -2, -2, -2, -2, 0, -1, 1, 0 };
+
+// Recorre el grafo de control desde pc 0 calculando la altura de la pila en
+// cada instruccion. Rechaza el programa si alguna instruccion alcanzable
+// puede vaciar la pila, usa un registro invalido, llega a un label con
+// alturas distintas o excede la capacidad de la pila. Si pasa, los motores
+// rapidos no necesitan ningun chequeo en tiempo de ejecucion.
+void Program::verify() {
+  int n = code.size();
+  height.assign(n, -1);
+  maxheight = 0;
+  exitheight = -1;
+  vector<int> work;
+  if (n == 0) {
+    exitheight = 0;
+    return;
+  }
+  height[0] = 0;
+  work.push_back(0);
+  while (!work.empty()) {
+    int i = work.back(); work.pop_back();
+    int op = code[i].op;
+    int h = height[i];
+    if (h < op_needs[op]) {
+      if (op == Instruction::IPOP) verror(i, "Can't pop from an empty stack");
+      else if (op == Instruction::IDUP) verror(i, "Can't dup from an empty stack");
+      else if (op == Instruction::ISTORE) verror(i, "Can't store from an empty stack");
+      else verror(i, "Not enough operands on the stack for " + snames[op]);
+    }
+    if ((op == Instruction::ISTORE || op == Instruction::ILOAD) &&
+	(code[i].arg > 7 || code[i].arg < 0))
+      verror(i, "Invalid register number");
+    h += op_delta[op];
+    if (h > maxheight) maxheight = h;
+    // sucesores
+    int succ[2], nsucc = 0;
+    if (op == Instruction::IGOTO)
+      succ[nsucc++] = code[i].arg;
+    else {
+      if (op >= Instruction::IJMPEQ && op <= Instruction::IJMPLE)
+	succ[nsucc++] = code[i].arg;
+      succ[nsucc++] = i+1;
+    }
+    for (int k=0; k < nsucc; k++) {
+      int j = succ[k];
+      if (j == n) {
+	if (exitheight != -1 && exitheight != h)
+	  verror(i, "Inconsistent stack height at end of program");
+	exitheight = h;
+      } else if (height[j] == -1) {
+	height[j] = h;
+	work.push_back(j);
+      } else if (height[j] != h)
+	verror(j, "Inconsistent stack height");
     }
   }
-  
+}
+
+/* ******** Superinstrucciones *********** */
+
+// Reescribe secuencias frecuentes de code en superinstrucciones (fcode).
+// Una secuencia solo se fusiona si ninguna de sus instrucciones, salvo la
+// primera, es destino de un salto; los destinos se reubican al final.
+void Program::fuse() {
+  int n = code.size();
+  vector<bool> target(n+1, false);
+  for (int i=0; i < n; i++)
+    if (isJump(code[i].op)) target[code[i].arg] = true;
+  vector<int> newpc(n+1, -1);
+  fcode.clear();
+  origin.clear();
+  fcode.reserve(n);
+  origin.reserve(n);
+  int i = 0;
+  while (i < n) {
+    const Code* c = &code[i];
+    // cuantas instrucciones desde i se pueden mirar sin cruzar un destino
+    int avail = 1;
+    while (avail < 4 && i+avail < n && !target[i+avail]) avail++;
+    Code f = c[0];
+    f.reg = 0;
+    int used = 1;
+    bool ext = false; // ocupa una segunda posicion con la constante
+    int extarg = 0;
+    if (avail >= 4 && c[0].op == Instruction::ILOAD && c[1].op == Instruction::IPUSH &&
+	(c[2].op == Instruction::IADD || c[2].op == Instruction::ISUB) &&
+	c[3].op == Instruction::ISTORE && c[3].arg == c[0].arg) {
+      f.op = FINCR; f.reg = c[0].arg;
+      f.arg = (c[2].op == Instruction::IADD) ? c[1].arg : (int) (0u - (unsigned) c[1].arg);
+      used = 4;
+    } else if (avail >= 3 && c[0].op == Instruction::ILOAD && c[1].op == Instruction::IPUSH &&
+	       isCondJump(c[2].op)) {
+      f.op = FJMPEQRI + (c[2].op - Instruction::IJMPEQ); f.reg = c[0].arg;
+      f.arg = c[2].arg; ext = true; extarg = c[1].arg;
+      used = 3;
+    } else if (avail >= 2 && c[0].op == Instruction::IPUSH && isCondJump(c[1].op)) {
+      f.op = FJMPEQI + (c[1].op - Instruction::IJMPEQ);
+      f.arg = c[1].arg; ext = true; extarg = c[0].arg;
+      used = 2;
+    } else if (avail >= 2 && c[0].op == Instruction::IPUSH && c[1].op == Instruction::IADD) {
+      f.op = FADDI; used = 2;
+    } else if (avail >= 2 && c[0].op == Instruction::IPUSH && c[1].op == Instruction::ISUB) {
+      f.op = FSUBI; used = 2;
+    } else if (avail >= 2 && c[0].op == Instruction::IDUP && c[1].op == Instruction::ISTORE) {
+      f.op = FTEE; f.reg = c[1].arg; f.arg = 0; used = 2;
+    }
+    newpc[i] = fcode.size();
+    fcode.push_back(f);
+    origin.push_back(i);
+    if (ext) {
+      Code e = { Instruction::ISKIP, 0, extarg };
+      fcode.push_back(e);
+      origin.push_back(i);
+    }
+    i += used;
+  }
+  newpc[n] = fcode.size();
+  // reubicar destinos de salto
+  for (int k=0; k < fcode.size(); k++) {
+    int op = fcode[k].op;
+    if (isJump(op) || (op >= FJMPEQRI && op <= FJMPLEI))
+      fcode[k].arg = newpc[fcode[k].arg];
+    if (op >= FJMPEQRI && op <= FJMPLEI) k++; // saltar la constante
+  }
+}
 
-					   
+void Program::verror(int i, string msg) const {
+  side();
+  Instruction* s = instructions[i];
+  msg += " (";
+  if (s->label != "")
+    msg += s->label + ": ";
+  msg += snames[s->type] + ", instruction " + to_string(i) + ")";
+  perror(msg);
 }
 
-void SVM::execute() {
+void ExecutionContext::execute() {
+  const Code* cp = prog.code.data();
+  int n = prog.code.size();
   while (true) {   
-    if (pc >= instructions.size()) break;
-    // cout << "pc " << pc << " ";
-    // print_stack();
-    execute(instructions[pc]);
+    if (pc >= n) break;
+    if (trace != NULL)
+      trace->record(pc, cp[pc].op, opstack.empty() ? 0 : opstack.top());
+    execute(cp[pc]);
   }
 }
 
-void SVM::execute(Instruction* instr) {
-  Instruction::IType itype = instr->type;
+void ExecutionContext::execute(const Code& instr) {
+  Instruction::IType itype = (Instruction::IType) instr.op;
   int next, top;
   //cout << "type: " << itype << endl;
   if (itype==Instruction::IPOP || itype==Instruction::IDUP || itype==Instruction::IPRINT || itype==Instruction::ISKIP) {
@@ -60,7 +323,7 @@ void SVM::execute(Instruction* instr) {
       opstack.pop(); break;
     case(Instruction::IDUP):
       if (opstack.empty()) perror("Can't dup from an empty stack");
-      opstack.push(opstack.top()); break;
+      push(opstack.top()); break;
     case(Instruction::IPRINT): print_stack(); break;
     case(Instruction::ISKIP): break;
     default: perror("Programming Error 1");
@@ -68,15 +331,15 @@ void SVM::execute(Instruction* instr) {
     pc++;
   } else if (itype==Instruction::IPUSH || itype==Instruction::ISTORE ||
 	     itype==Instruction::ILOAD) {
-    int arg = instr->argint;
+    int arg = instr.arg;
     switch (itype) {
-    case(Instruction::IPUSH): opstack.push(instr->argint); break;
+    case(Instruction::IPUSH): push(instr.arg); break;
     case (Instruction::ISTORE):
       if (opstack.empty()) perror("Can't store from an empty stack");
-      register_write(instr->argint, opstack.top()); opstack.pop(); break;
+      register_write(instr.arg, opstack.top()); opstack.pop(); break;
       break;
     case(Instruction::ILOAD):
-      opstack.push(register_read(instr->argint)); break;
+      push(register_read(instr.arg)); break;
       break;
     default: perror("Programming Error 2");
     }
@@ -95,7 +358,7 @@ void SVM::execute(Instruction* instr) {
     case(Instruction::IJMPLE): jump = (next<=top); break;
     default: perror("Programming Error 3");
     }
-    if (jump) pc=instr->argint; else pc++;
+    if (jump) pc=instr.arg; else pc++;
   } else if (itype==Instruction::IADD || itype==Instruction::ISUB || itype==Instruction::IMUL
 	     || itype==Instruction::IDIV || itype==Instruction::ISWAP) {
     top = opstack.top(); opstack.pop();
@@ -104,37 +367,272 @@ void SVM::execute(Instruction* instr) {
     case(Instruction::IADD): opstack.push(next+top); break;
     case(Instruction::ISUB): opstack.push(next-top); break;
     case(Instruction::IMUL): opstack.push(next*top); break;
-    case(Instruction::IDIV): opstack.push(next/top); break;
+    case(Instruction::IDIV): opstack.push(divide(next, top)); break;
     case(Instruction::ISWAP): opstack.push(top); opstack.push(next); break;
     default: perror("Programming Error 4");
     }
     pc++;
   } else if (itype == Instruction::IGOTO) {
-    pc = instr->argint;
+    pc = instr.arg;
   } else {
-    cout << "Programming Error: execute instruction" << endl;
-    exit(0);
+    perror("Programming Error: execute instruction");
+  }
+}
+
+/* ******** Motores de despacho *********** */
+
+const char* ExecutionContext::engine_names[6] = { "classic", "switch", "goto", "threaded", "register", "jit" };
+
+bool ExecutionContext::engineFromName(string name, Engine& e) {
+  for (int i=0; i < 6; i++)
+    if (name == engine_names[i]) {
+      e = (Engine) i;
+      return true;
+    }
+  return false;
+}
+
+// Con traza el clasico registra en execute(), el switch corre como el
+// ciclo con traza sobre code y el threaded registra cada instruccion que
+// despacha. goto, register y jit no registran: corren como el threaded.
+void ExecutionContext::execute(Engine engine) {
+  if (trace != NULL && engine != ENGINE_CLASSIC) {
+    if (engine == ENGINE_SWITCH) run_trace();
+    else run_threaded();
+    return;
+  }
+  switch (engine) {
+  case ENGINE_CLASSIC: execute(); break;
+  case ENGINE_SWITCH: run_switch(); break;
+  case ENGINE_GOTO: run_goto(); break;
+  case ENGINE_THREADED: run_threaded(); break;
+  case ENGINE_REGISTER: run_register(); break;
+  case ENGINE_JIT: // sin JIT en esta plataforma se interpreta
+    if (!run_jit()) run_threaded();
+    break;
+  }
+}
+
+// Acceso a la pila desde los motores: el tope vive en la variable local sp
+// (siguiente posicion libre) y solo se sincroniza con opstack antes de
+// print_stack y al terminar. El programa ya paso verify(), asi que estos
+// motores no revisan underflow, overflow ni numeros de registro.
+#define SVM_STACK_LOCALS int* base = opstack.base(); int* sp = base + opstack.size()
+#define SYNC opstack.resize(sp - base)
+
+// Un solo switch por instruccion, sin clasificacion previa
+void ExecutionContext::run_switch() {
+  const Code* cp = prog.fcode.data();
+  int n = prog.fcode.size();
+  int top;
+  SVM_STACK_LOCALS;
+  while (pc < n) {
+    const Code& c = cp[pc];
+    switch (c.op) {
+    case Instruction::IPUSH: *sp++ = c.arg; pc++; break;
+    case Instruction::IPOP: sp--; pc++; break;
+    case Instruction::IDUP: *sp = sp[-1]; sp++; pc++; break;
+    case Instruction::ISWAP:
+      top = sp[-1]; sp[-1] = sp[-2]; sp[-2] = top; pc++; break;
+    case Instruction::IADD: sp--; sp[-1] += *sp; pc++; break;
+    case Instruction::ISUB: sp--; sp[-1] -= *sp; pc++; break;
+    case Instruction::IMUL: sp--; sp[-1] *= *sp; pc++; break;
+    case Instruction::IDIV: sp--; sp[-1] = divide(sp[-1], *sp); pc++; break;
+    case Instruction::IGOTO: pc = c.arg; break;
+    case Instruction::IJMPEQ:
+      sp -= 2; pc = (sp[0] == sp[1]) ? c.arg : pc+1; break;
+    case Instruction::IJMPGT:
+      sp -= 2; pc = (sp[0] > sp[1]) ? c.arg : pc+1; break;
+    case Instruction::IJMPGE:
+      sp -= 2; pc = (sp[0] >= sp[1]) ? c.arg : pc+1; break;
+    case Instruction::IJMPLT:
+      sp -= 2; pc = (sp[0] < sp[1]) ? c.arg : pc+1; break;
+    case Instruction::IJMPLE:
+      sp -= 2; pc = (sp[0] <= sp[1]) ? c.arg : pc+1; break;
+    case Instruction::ISKIP: pc++; break;
+    case Instruction::ISTORE: sp--; registers[c.arg] = *sp; pc++; break;
+    case Instruction::ILOAD: *sp++ = registers[c.arg]; pc++; break;
+    case Instruction::IPRINT: SYNC; print_stack(); pc++; break;
+    case FADDI: sp[-1] += c.arg; pc++; break;
+    case FSUBI: sp[-1] -= c.arg; pc++; break;
+    case FTEE: registers[c.reg] = sp[-1]; pc++; break;
+    case FINCR: registers[c.reg] += c.arg; pc++; break;
+    case FJMPEQRI: pc = (registers[c.reg] == cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPGTRI: pc = (registers[c.reg] > cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPGERI: pc = (registers[c.reg] >= cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPLTRI: pc = (registers[c.reg] < cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPLERI: pc = (registers[c.reg] <= cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPEQI: sp--; pc = (*sp == cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPGTI: sp--; pc = (*sp > cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPGEI: sp--; pc = (*sp >= cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPLTI: sp--; pc = (*sp < cp[pc+1].arg) ? c.arg : pc+2; break;
+    case FJMPLEI: sp--; pc = (*sp <= cp[pc+1].arg) ? c.arg : pc+2; break;
+    default: SYNC; perror("Programming Error: run_switch");
+    }
   }
+  SYNC;
+}
+
+#if defined(__GNUC__)
+
+// Cuerpos compartidos por los motores con labels-as-values (GCC).
+// NEXT despacha a la siguiente instruccion, NEXT2 salta tambien la constante
+// de un salto fusionado, JUMP salta al destino de la actual. REG y EXT son el
+// registro y la constante de las superinstrucciones.
+#define SVM_HANDLERS						\
+ L_PUSH: *sp++ = ARG; NEXT;					\
+ L_POP: sp--; NEXT;						\
+ L_DUP: *sp = sp[-1]; sp++; NEXT;				\
+ L_SWAP: top = sp[-1]; sp[-1] = sp[-2]; sp[-2] = top; NEXT;	\
+ L_ADD: sp--; sp[-1] += *sp; NEXT;				\
+ L_SUB: sp--; sp[-1] -= *sp; NEXT;				\
+ L_MUL: sp--; sp[-1] *= *sp; NEXT;				\
+ L_DIV: sp--; sp[-1] = divide(sp[-1], *sp); NEXT;		\
+ L_GOTO: JUMP;							\
+ L_JMPEQ: sp -= 2; if (sp[0] == sp[1]) JUMP; NEXT;		\
+ L_JMPGT: sp -= 2; if (sp[0] > sp[1]) JUMP; NEXT;		\
+ L_JMPGE: sp -= 2; if (sp[0] >= sp[1]) JUMP; NEXT;		\
+ L_JMPLT: sp -= 2; if (sp[0] < sp[1]) JUMP; NEXT;		\
+ L_JMPLE: sp -= 2; if (sp[0] <= sp[1]) JUMP; NEXT;		\
+ L_SKIP: NEXT;							\
+ L_STORE: sp--; registers[ARG] = *sp; NEXT;			\
+ L_LOAD: *sp++ = registers[ARG]; NEXT;				\
+ L_PRINT: SYNC; print_stack(); NEXT;				\
+ L_ADDI: sp[-1] += ARG; NEXT;					\
+ L_SUBI: sp[-1] -= ARG; NEXT;					\
+ L_TEE: registers[REG] = sp[-1]; NEXT;				\
+ L_INCR: registers[REG] += ARG; NEXT;				\
+ L_JMPEQRI: if (registers[REG] == EXT) JUMP; NEXT2;		\
+ L_JMPGTRI: if (registers[REG] > EXT) JUMP; NEXT2;		\
+ L_JMPGERI: if (registers[REG] >= EXT) JUMP; NEXT2;		\
+ L_JMPLTRI: if (registers[REG] < EXT) JUMP; NEXT2;		\
+ L_JMPLERI: if (registers[REG] <= EXT) JUMP; NEXT2;		\
+ L_JMPEQI: sp--; if (*sp == EXT) JUMP; NEXT2;			\
+ L_JMPGTI: sp--; if (*sp > EXT) JUMP; NEXT2;			\
+ L_JMPGEI: sp--; if (*sp >= EXT) JUMP; NEXT2;			\
+ L_JMPLTI: sp--; if (*sp < EXT) JUMP; NEXT2;			\
+ L_JMPLEI: sp--; if (*sp <= EXT) JUMP; NEXT2;
+
+// mismo orden que Instruction::IType seguido de FusedOp
+#define SVM_LABEL_TABLE { &&L_PUSH, &&L_POP, &&L_DUP, &&L_SWAP, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV, &&L_GOTO, &&L_JMPEQ, &&L_JMPGT, &&L_JMPGE, &&L_JMPLT, &&L_JMPLE, &&L_SKIP, &&L_STORE, &&L_LOAD, &&L_PRINT, \
+      &&L_ADDI, &&L_SUBI, &&L_TEE, &&L_INCR, &&L_JMPEQRI, &&L_JMPGTRI, &&L_JMPGERI, &&L_JMPLTRI, &&L_JMPLERI, &&L_JMPEQI, &&L_JMPGTI, &&L_JMPGEI, &&L_JMPLTI, &&L_JMPLEI }
+
+// Computed goto: cada handler despacha por su cuenta a traves de la tabla
+void ExecutionContext::run_goto() {
+  static const void* table[] = SVM_LABEL_TABLE;
+  const Code* cp = prog.fcode.data();
+  int n = prog.fcode.size();
+  int top;
+  SVM_STACK_LOCALS;
+#define ARG cp[pc].arg
+#define REG cp[pc].reg
+#define EXT cp[pc+1].arg
+#define NEXT do { if (++pc >= n) goto L_END; goto *table[cp[pc].op]; } while (0)
+#define NEXT2 do { pc += 2; if (pc >= n) goto L_END; goto *table[cp[pc].op]; } while (0)
+#define JUMP do { pc = cp[pc].arg; goto *table[cp[pc].op]; } while (0)
+  if (pc >= n) return;
+  goto *table[cp[pc].op];
+  SVM_HANDLERS
+ L_END:
+  SYNC;
+#undef ARG
+#undef REG
+#undef EXT
+#undef NEXT
+#undef NEXT2
+#undef JUMP
 }
 
-void SVM::print_stack() {
-  stack<int> local;
-  cout << "stack [ ";
-  while(!opstack.empty()) {
-    cout << opstack.top() << " ";
-    local.push(opstack.top());
-    opstack.pop();
+// Direct threading: el programa se traduce a direcciones de handler ya
+// resueltas; los saltos apuntan directamente al destino. Con traza cada
+// entrada apunta a L_TRACE, que registra la instruccion (con su posicion en
+// code) y sigue en el handler real; sin traza no se paga nada.
+struct Threaded {
+  const void* handler;
+  int arg;
+  int reg;
+};
+
+void ExecutionContext::run_threaded() {
+  static const void* table[] = SVM_LABEL_TABLE;
+  int n = prog.fcode.size();
+  vector<Threaded> tcode(n+1);
+  struct Traced { const void* handler; int pc, op; }; // handler real y lo que se registra
+  vector<Traced> traced(trace != NULL ? n : 0);
+  for (int i=0; i < n; i++) {
+    tcode[i].handler = table[prog.fcode[i].op];
+    tcode[i].arg = prog.fcode[i].arg;
+    tcode[i].reg = prog.fcode[i].reg;
+    if (trace != NULL) {
+      Traced t = { tcode[i].handler, prog.origin[i], prog.fcode[i].op };
+      traced[i] = t;
+      tcode[i].handler = &&L_TRACE;
+    }
   }
-  cout << "]" << endl;
-  while(!local.empty()) {
-    opstack.push(local.top());
-    local.pop();
+  tcode[n].handler = &&L_END;
+  const Threaded* tc = tcode.data();
+  const Threaded* ip = tc + pc;
+  int top;
+  SVM_STACK_LOCALS;
+#define ARG ip->arg
+#define REG ip->reg
+#define EXT ip[1].arg
+#define NEXT do { ip++; goto *ip->handler; } while (0)
+#define NEXT2 do { ip += 2; goto *ip->handler; } while (0)
+#define JUMP do { ip = tc + ip->arg; goto *ip->handler; } while (0)
+  if (pc >= n) return;
+  goto *ip->handler;
+  SVM_HANDLERS
+ L_TRACE: {
+    const Traced& t = traced[ip - tc];
+    trace->record(t.pc, t.op, sp > base ? sp[-1] : 0);
+    goto *t.handler;
   }
+ L_END:
+  pc = n;
+  SYNC;
+#undef ARG
+#undef REG
+#undef EXT
+#undef NEXT
+#undef NEXT2
+#undef JUMP
+}
+
+#undef SVM_HANDLERS
+#undef SVM_LABEL_TABLE
+
+#else
+
+void ExecutionContext::run_goto() { run_switch(); }
+
+void ExecutionContext::run_threaded() {
+  if (trace != NULL) run_trace();
+  else run_switch();
+}
+
+#endif
+
+#undef SVM_STACK_LOCALS
+#undef SYNC
+
+void ExecutionContext::print_stack() {
+  *out << "stack [ ";
+  for (const int* p = opstack.end(); p != opstack.begin(); )
+    *out << *--p << " ";
+  *out << "]" << endl;
 }
 
-void SVM::print() {
+// Con un perfil, cada linea va precedida por su cantidad de ejecuciones y
+// los saltos condicionales llevan cuantas veces saltaron y cuantas no.
+void Program::print(const Profile* prof) const {
+  side();
   for(int i= 0; i < instructions.size(); i++) {
     Instruction* s = instructions[i];
+    if (prof != NULL) {
+      cout.width(12);
+      cout << prof->count[i] << "  ";
+    }
     if (s->label != "")
       cout << s->label << ": ";
     cout << snames[s->type] << " ";
@@ -146,27 +644,43 @@ void SVM::print() {
 	// cout << "  [" << s->argint << "]";
       }
     }
+    if (prof != NULL && isCondJump(s->type))
+      cout << "   [taken " << prof->taken[i] << ", not taken "
+	   << prof->count[i] - prof->taken[i] << "]";
     cout << endl;
   }					    
 }
 
 
-void SVM::register_write(int r,int v) {
+void ExecutionContext::push(int v) {
+  if (opstack.full())
+    perror("Stack overflow");
+  opstack.push(v);
+}
+
+void ExecutionContext::register_write(int r,int v) {
   if (r > 7 || r < 0)
     perror("Invalid register number");
   registers[r] = v;
 }
   
-int SVM::register_read(int r) {
+int ExecutionContext::register_read(int r) {
   if (r > 7 || r < 0)
     perror("Invalid register number");
   return registers[r];
 }
 
     
-void SVM::perror(string msg) {
-  cout << "error: " << msg << endl;
-  exit(0);
+void Program::perror(string msg) const {
+  throw SVMError("error: " + msg);
+}
+
+void ExecutionContext::perror(string msg) {
+  throw SVMError("error: " + msg);
+}
+
+void ExecutionContext::divisionError() {
+  throw SVMError("error: Division by zero");
 }
 
 
@@ -2,10 +2,16 @@
 #define SVMHH
 
 #include <string>
+#include <iostream>
 #include <list>
-#include <stack>
 #include <vector>
 #include <unordered_map>
+#include <cstdint>
+#include <climits>
+#include <stdexcept>
+#include <mutex>
+#include <functional>
+#include <memory>
 
 using namespace std;
 
@@ -24,24 +30,203 @@ public:
 };
 
 
-class SVM {
+inline bool isJump(int op) {
+  return op >= Instruction::IGOTO && op <= Instruction::IJMPLE;
+}
+
+inline bool isCondJump(int op) {
+  return op >= Instruction::IJMPEQ && op <= Instruction::IJMPLE;
+}
+
+
+// Codificacion compacta de una instruccion ya resuelta: opcode + operando
+// (entero o indice de salto). Es lo unico que lee el interprete.
+struct Code {
+  uint8_t op;   // Instruction::IType o FusedOp
+  uint8_t reg;  // registro de las superinstrucciones
+  int32_t arg;
+};
+
+// Superinstrucciones internas que genera Program::fuse(). Los saltos *RI / *I
+// ocupan dos posiciones: la segunda solo guarda la constante en arg.
+enum FusedOp {
+  FADDI = Instruction::IPRINT+1, // push k; add
+  FSUBI,                         // push k; sub
+  FTEE,                          // dup; store r
+  FINCR,                         // load r; push k; add|sub; store r
+  FJMPEQRI, FJMPGTRI, FJMPGERI, FJMPLTRI, FJMPLERI, // load r; push k; jmpXX L
+  FJMPEQI, FJMPGTI, FJMPGEI, FJMPLTI, FJMPLEI,      // push k; jmpXX L
+  NUM_OPS
+};
+
+extern string snames[NUM_OPS];
+
+static_assert(sizeof(Code) == 8, "Code debe ocupar 8 bytes");
+
+
+// Forma de registros (tres direcciones) que genera Program::translate(). Los
+// operandos son registros virtuales: 0..7 son los registros del SVM, 8+h es
+// el slot h de la pila y los siguientes son temporales.
+struct RCode {
+  enum ROp { RMOV=0, RMOVI, RADD, RADDI, RSUB, RSUBI, RMUL, RMULI, RDIV, RDIVI,
+	     RGOTO, RJEQ, RJGT, RJGE, RJLT, RJLE, RJEQI, RJGTI, RJGEI, RJLTI, RJLEI, RPRINT };
+  uint16_t op, dst, a, b;
+  int32_t imm;    // constante (o altura de la pila en RPRINT)
+  int32_t target; // destino de los saltos
+};
+
+
+// Pila de operandos contigua de capacidad fija. Los motores trabajan con un
+// puntero local al tope (base()/resize()); begin()/end() dan una vista de
+// solo lectura del fondo al tope.
+class OpStack {
+  int* data;
+  int sp; // cantidad de elementos
+  int cap;
+public:
+  OpStack(int cap);
+  ~OpStack();
+  // data es propio: una copia lo liberaria dos veces
+  OpStack(const OpStack&) = delete;
+  OpStack& operator=(const OpStack&) = delete;
+  bool empty() const { return sp == 0; }
+  bool full() const { return sp == cap; }
+  int size() const { return sp; }
+  int capacity() const { return cap; }
+  int& top() { return data[sp-1]; }
+  void push(int v) { data[sp++] = v; }
+  void pop() { sp--; }
+  int* base() { return data; }
+  void resize(int n) { sp = n; }
+  const int* begin() const { return data; }
+  const int* end() const { return data + sp; }
+};
+
+
+class Profile;
+class TraceBuffer;
+
+// Error del programa (parser, carga o ejecucion). what() es el mensaje tal
+// como se muestra; quien ejecuta decide si termina o sigue con otro programa.
+class SVMError : public runtime_error {
+public:
+  SVMError(const string& msg):runtime_error(msg) { }
+};
+
+// Corre f(0), ..., f(n-1), cada uno en su hilo (f(0) en el que llama), y
+// vuelve cuando terminan todos
+void parallelFor(int n, const function<void(int)>& f);
+
+// Programa cargado: instrucciones con los labels resueltos, verificadas y
+// con superinstrucciones. No cambia despues de construirse, asi que varios
+// ExecutionContext pueden ejecutar el mismo Program a la vez, desde hilos
+// distintos, sin copiarlo.
+class Program {
+  friend class ExecutionContext;
+  friend class Image;
+  vector<Code> code; // flujo contiguo de instrucciones (verificado)
+  vector<Code> fcode; // code con superinstrucciones: lo que ejecutan los motores rapidos
+  vector<int> origin; // fcode -> indice en code
+  mutable vector<Instruction*> instructions; // tabla lateral (labels, nombres): solo print y errores
+  // Cargado de una imagen: la tabla lateral se arma la primera vez que se
+  // usa (side()), a partir de los labels guardados en la imagen
+  vector<int32_t> imagenames; // label y jmplabel de cada instruccion (-1: sin label)
+  string imagestrings;
+  mutable once_flag sideonce;
+  void side() const;
+  vector<int> height; // altura de la pila antes de cada instruccion (-1: inalcanzable)
+  int maxheight, exitheight;
+  bool owner; // instructions se crearon aqui (imagen) y se liberan con el Program
+  Program():owner(true) { }
+  void resolveLabels();
+  void verify();
+  void verror(int i, string msg) const;
+  void fuse();
+  void perror(string msg) const;
+public:
+  Program(list<Instruction*>& sl);
+  ~Program();
+  int size() const { return code.size(); }
+  int stackNeeded() const { return maxheight; }
+  bool translate(vector<RCode>& rcode, int& nvregs) const;
+  void print(const Profile* prof = NULL) const;
+  void print_profile(const Profile& prof) const;
+  void profile_json(const Profile& prof, ostream& out) const;
+  void emit_c(ostream& out) const;
+  void sweep(const vector<vector<int> >& inputs, ostream& out) const;
+};
+
+
+// Estado de una ejecucion: pila, registros y pc. Es liviano y solo lee el
+// Program, que debe vivir mas que el contexto.
+class ExecutionContext {
+public:
+  // Estrategias de despacho del interprete
+  enum Engine { ENGINE_CLASSIC=0, ENGINE_SWITCH, ENGINE_GOTO, ENGINE_THREADED, ENGINE_REGISTER, ENGINE_JIT };
+  static const char* engine_names[6];
+  static bool engineFromName(string name, Engine& e);
+  static const int DEFAULT_STACK = 65536;
+protected:
+  const Program& prog;
 private:
-  stack<int> opstack;
+  OpStack opstack;
   int registers[8];
-  vector<Instruction*> instructions;
-  unordered_map<string,int> labels;
   int pc; // program counter
-  void execute(Instruction* s);
+  TraceBuffer* trace; // NULL: sin traza
+  ostream* out; // salida de print
+  void execute(const Code& c);
+  void run_switch();
+  void run_goto();
+  void run_threaded();
+  void run_register();
+  template<class Hook> void run_hooked(Hook& hook);
+  void run_profile(Profile& prof);
+  void run_trace();
+  bool run_jit();
+  static void jit_print(ExecutionContext* vm, int h);
+  // Division de los motores: entre 0 (o INT_MIN / -1, que tampoco cabe) es
+  // un SVMError como cualquier otro error de ejecucion
+  static int divide(int a, int b) {
+    if (b == 0 || (a == INT_MIN && b == -1)) divisionError();
+    return a / b;
+  }
+  [[noreturn]] static void divisionError();
   void perror(string msg);
   void register_write(int,int);
   int register_read(int);
+  void push(int v);
 public:
-  SVM(list<Instruction*>&  sl);
+  ExecutionContext(const Program& p, int maxdepth = DEFAULT_STACK);
+  const Program& program() const { return prog; }
   void execute();
+  void execute(Engine engine);
+  void execute(Profile& prof);
+  void set_trace(TraceBuffer* t);
+  TraceBuffer* get_trace() const { return trace; }
+  void set_output(ostream& o) { out = &o; }
   void print_stack();
-  void print();
   int top();
 };
 
 
+// Dueno del Program de un SVM. Es la primera base, asi que el Program ya
+// existe al construir el ExecutionContext y se libera si este falla.
+struct ProgramOwner {
+  unique_ptr<Program> owned;
+  ProgramOwner(Program* p):owned(p) { }
+};
+
+// La interfaz de siempre: un contexto con su propio Program
+class SVM : private ProgramOwner, public ExecutionContext {
+public:
+  SVM(list<Instruction*>&  sl, int maxdepth = DEFAULT_STACK);
+  SVM(Program* p, int maxdepth = DEFAULT_STACK); // toma posesion de p
+  void print(const Profile* prof = NULL) { prog.print(prof); }
+  void print_profile(const Profile& p) { prog.print_profile(p); }
+  void profile_json(const Profile& p, ostream& out) { prog.profile_json(p, out); }
+  void emit_c(ostream& out) { prog.emit_c(out); }
+  void sweep(const vector<vector<int> >& inputs, ostream& out) { prog.sweep(inputs, out); }
+};
+
+
 #endif
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "svm_batch.hh"
+#include "svm_parser.hh"
+#include "svm_opt.hh"
+#include "svm_image.hh"
+#include "svm_source.hh"
+
+/* ******** Pool con robo de trabajo *********** */
+
+void TaskQueue::push(int t) {
+  lock_guard<mutex> lock(m);
+  tasks.push_back(t);
+}
+
+bool TaskQueue::take(int& t) {
+  lock_guard<mutex> lock(m);
+  if (tasks.empty()) return false;
+  t = tasks.front();
+  tasks.pop_front();
+  return true;
+}
+
+bool TaskQueue::steal(int& t) {
+  lock_guard<mutex> lock(m);
+  if (tasks.empty()) return false;
+  t = tasks.back();
+  tasks.pop_back();
+  return true;
+}
+
+WorkStealingPool::WorkStealingPool(int n):nthreads(n > 0 ? n : 1),queues(nthreads) {
+}
+
+void WorkStealingPool::worker(int id, const function<void(int)>& task) {
+  int t;
+  while (true) {
+    if (queues[id].take(t)) {
+      task(t);
+      continue;
+    }
+    // la cola propia se vacio: robar a los demas, empezando por el vecino
+    bool stolen = false;
+    for (int k=1; k < nthreads && !stolen; k++)
+      stolen = queues[(id + k) % nthreads].steal(t);
+    if (!stolen) return; // nadie agrega tareas despues de empezar
+    task(t);
+  }
+}
+
+void WorkStealingPool::run(int n, const function<void(int)>& task) {
+  // reparto circular: cada hilo avanza por la entrada en orden, de modo que
+  // las salidas se completan mas o menos en el orden en que se emiten
+  for (int i=0; i < n; i++)
+    queues[i % nthreads].push(i);
+  vector<thread> threads;
+  for (int id=0; id < nthreads; id++)
+    threads.push_back(thread(&WorkStealingPool::worker, this, id, cref(task)));
+  for (int id=0; id < nthreads; id++)
+    threads[id].join();
+}
+
+/* ******** Modo --batch *********** */
+
+Batch::Batch():engine(ExecutionContext::ENGINE_THREADED),maxdepth(ExecutionContext::DEFAULT_STACK),
+	       optimize(false),nthreads(0),cache(NULL),failed(0) {
+}
+
+bool Batch::listFiles(const string& path, vector<string>& files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  if (S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) return false;
+    struct dirent* e;
+    while ((e = readdir(dir)) != NULL) {
+      string name = e->d_name;
+      if ((name.size() > 4 && name.compare(name.size()-4, 4, ".svm") == 0) ||
+	  (name.size() > 5 && name.compare(name.size()-5, 5, ".svbc") == 0))
+	files.push_back(path + "/" + name);
+    }
+    closedir(dir);
+    sort(files.begin(), files.end());
+    return true;
+  }
+  std::ifstream in(path.c_str());
+  if (!in) return false;
+  string line;
+  while (getline(in, line))
+    if (!line.empty() && line[0] != '#')
+      files.push_back(line);
+  return true;
+}
+
+// Parser (o imagen), carga y ejecucion de un archivo. Devuelve false si fallo.
+bool Batch::runFile(const string& fname, ostream& out) {
+  list<Instruction*> sl;
+  Program* prog = NULL;
+  bool ok = true;
+  try {
+    if (Image::isImage(fname))
+      prog = Image::load(fname);
+    else {
+      MappedFile src;
+      if (!src.open(fname))
+	throw SVMError("error: Can't read " + fname);
+      string key;
+      if (cache != NULL) {
+	key = cache->key(src.data(), src.size(), optimize ? ImageCache::OPTIMIZE : 0);
+	prog = cache->lookup(key);
+      }
+      if (prog == NULL) {
+	Scanner scanner(src.data(), src.size());
+	Parser parser(&scanner);
+	parser.parse(sl);
+	if (optimize) {
+	  Optimizer opt;
+	  opt.optimize(sl);
+	}
+	prog = new Program(sl);
+	if (cache != NULL) cache->store(key, *prog);
+      }
+    }
+    ExecutionContext ctx(*prog, maxdepth);
+    ctx.set_output(out);
+    ctx.execute(engine);
+    ctx.print_stack();
+  } catch (SVMError& e) {
+    out << e.what() << endl;
+    ok = false;
+  } catch (exception& e) { // p.ej. bad_alloc con un programa enorme
+    out << "error: " << e.what() << endl;
+    ok = false;
+  }
+  delete prog;
+  for (list<Instruction*>::iterator it = sl.begin(); it != sl.end(); ++it)
+    delete *it;
+  return ok;
+}
+
+void Batch::run(const vector<string>& files, ostream& out) {
+  int n = files.size();
+  WorkStealingPool pool(nthreads > 0 ? nthreads : thread::hardware_concurrency());
+  vector<string> outputs(n);
+  vector<bool> done(n, false);
+  mutex m;
+  condition_variable ready;
+  failed = 0;
+
+  // los hilos del pool ejecutan; este hilo escribe las salidas en orden
+  thread workers([&] {
+    pool.run(n, [&](int i) {
+      std::ostringstream buf;
+      buf << "==> " << files[i] << " <==" << endl;
+      bool ok = runFile(files[i], buf);
+      lock_guard<mutex> lock(m);
+      outputs[i] = buf.str();
+      done[i] = true;
+      if (!ok) failed++;
+      ready.notify_one();
+    });
+  });
+  for (int i=0; i < n; i++) {
+    unique_lock<mutex> lock(m);
+    ready.wait(lock, [&] { return done[i]; });
+    string text;
+    text.swap(outputs[i]);
+    lock.unlock();
+    out << text;
+  }
+  workers.join();
+  out.flush();
+}
@@ -0,0 +1,63 @@
+#ifndef SVM_BATCH
+#define SVM_BATCH
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <iostream>
+
+#include "svm.hh"
+#include "svm_cache.hh"
+
+using namespace std;
+
+
+// Cola de tareas de un hilo del pool. El dueno toma del principio, en el
+// orden de la entrada; los demas hilos roban del final.
+class TaskQueue {
+  mutex m;
+  deque<int> tasks;
+public:
+  void push(int t);
+  bool take(int& t);
+  bool steal(int& t);
+};
+
+// Pool de hilos con robo de trabajo: las tareas 0..n-1 se reparten entre
+// las colas y cada hilo, cuando vacia la suya, roba de las de los demas.
+class WorkStealingPool {
+  int nthreads;
+  vector<TaskQueue> queues;
+  void worker(int id, const function<void(int)>& task);
+public:
+  WorkStealingPool(int nthreads);
+  int size() const { return nthreads; }
+  // Ejecuta task(i) para cada i < n y vuelve cuando todas terminaron
+  void run(int n, const function<void(int)>& task);
+};
+
+
+// Modo --batch: ejecuta muchos programas en un solo proceso.
+class Batch {
+public:
+  ExecutionContext::Engine engine;
+  int maxdepth;
+  bool optimize;
+  int nthreads; // 0: uno por nucleo
+  ImageCache* cache; // NULL: sin cache
+  int failed;
+  Batch();
+  // path es un directorio (sus .svm y .svbc, por nombre) o un archivo con
+  // una ruta por linea. Devuelve false si no se puede leer.
+  static bool listFiles(const string& path, vector<string>& files);
+  // Corre cada archivo en un contexto propio y escribe en out la salida de
+  // cada uno, en el orden de files, a medida que va estando lista.
+  void run(const vector<string>& files, ostream& out);
+private:
+  bool runFile(const string& fname, ostream& out);
+};
+
+
+#endif
@@ -0,0 +1,398 @@
+#include <sstream>
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <sys/resource.h>
+
+#include "svm_parser.hh"
+#include "svm_index.hh"
+#include "svm.hh"
+
+/* ******** Benchmarks del SVM *********** */
+
+// Cargas de trabajo generadas. Cada una es un ciclo externo de n
+// iteraciones (registro 7) con un cuerpo de largo fijo, asi que la cantidad
+// de instrucciones ejecutadas se conoce sin contarlas: prologo + n * cuerpo.
+struct Workload {
+  const char* name;
+  const char* description;
+  uint64_t prologue, body; // instrucciones ejecutadas
+  void (*gen)(ostream& out);
+};
+
+// Decrementa el registro r y vuelve a L mientras sea mayor que 0 (7 instrucciones)
+static void loopEnd(ostream& out, int r, string l) {
+  out << "load " << r << endl << "push 1" << endl << "sub" << endl << "dup" << endl
+      << "store " << r << endl << "push 0" << endl << "jmpgt " << l << endl;
+}
+
+// n veces 12!
+static void genFactorial(ostream& out) {
+  out << "L0: push 1" << endl << "store 1" << endl << "push 12" << endl << "store 2" << endl;
+  out << "L1: load 1" << endl << "load 2" << endl << "mul" << endl << "store 1" << endl;
+  loopEnd(out, 2, "L1");
+  loopEnd(out, 7, "L0");
+}
+
+// n veces los primeros 40 numeros de Fibonacci
+static void genFib(ostream& out) {
+  out << "L0: push 0" << endl << "store 1" << endl << "push 1" << endl << "store 2" << endl
+      << "push 40" << endl << "store 3" << endl;
+  out << "L1: load 1" << endl << "load 2" << endl << "dup" << endl << "store 1" << endl
+      << "add" << endl << "store 2" << endl;
+  loopEnd(out, 3, "L1");
+  loopEnd(out, 7, "L0");
+}
+
+// tres ciclos anidados (n x 10 x 100) que incrementan un contador
+static void genNested(ostream& out) {
+  out << "L0: push 10" << endl << "store 6" << endl;
+  out << "L1: push 100" << endl << "store 5" << endl;
+  out << "L2: load 4" << endl << "push 1" << endl << "add" << endl << "store 4" << endl;
+  loopEnd(out, 5, "L2");
+  loopEnd(out, 6, "L1");
+  loopEnd(out, 7, "L0");
+}
+
+static const int CHURN_DEPTH = 256;
+
+// llena la pila hasta CHURN_DEPTH y la reduce con sumas
+static void genChurn(ostream& out) {
+  for (int k=0; k < CHURN_DEPTH; k++)
+    out << (k == 0 ? "L0: " : "") << "push " << k << endl;
+  for (int k=1; k < CHURN_DEPTH; k++)
+    out << "add" << endl;
+  out << "pop" << endl;
+  loopEnd(out, 7, "L0");
+}
+
+// cadena de divisiones por constantes y por un registro
+static void genDiv(ostream& out) {
+  out << "push 3" << endl << "store 6" << endl;
+  out << "L0: load 7" << endl;
+  for (int d=2; d < 6; d++)
+    out << "push " << d << endl << "div" << endl;
+  out << "load 7" << endl << "load 6" << endl << "div" << endl << "add" << endl << "store 1" << endl;
+  loopEnd(out, 7, "L0");
+}
+
+// saltos impredecibles: el bit alto de un generador congruencial decide
+// cual de dos contadores se incrementa (ambos caminos tienen 5 instrucciones)
+static void genBranch(ostream& out) {
+  out << "push 1" << endl << "store 1" << endl;
+  out << "L0: load 1" << endl << "push 1103515245" << endl << "mul" << endl
+      << "push 12345" << endl << "add" << endl << "store 1" << endl;
+  out << "load 1" << endl << "push 0" << endl << "jmplt LA" << endl;
+  out << "load 2" << endl << "push 1" << endl << "add" << endl << "store 2" << endl << "goto LB" << endl;
+  out << "LA: load 3" << endl << "push 1" << endl << "add" << endl << "store 3" << endl << "skip" << endl;
+  out << "LB: skip" << endl;
+  loopEnd(out, 7, "L0");
+}
+
+static Workload workloads[] = {
+  { "factorial", "12! in a loop", 2, 4 + 12*11 + 7, genFactorial },
+  { "fib", "40 Fibonacci steps in a loop", 2, 6 + 40*13 + 7, genFib },
+  { "nested", "three nested counting loops", 2, 2 + 10*(2 + 100*(4+7) + 7) + 7, genNested },
+  { "churn", "stack filled to 256 slots and reduced", 2, 2*CHURN_DEPTH + 7, genChurn },
+  { "div", "division chains", 4, 14 + 7, genDiv },
+  { "branch", "data-dependent branches", 4, 6 + 3 + 5 + 1 + 7, genBranch },
+};
+static const int NUM_WORKLOADS = sizeof(workloads) / sizeof(workloads[0]);
+
+// Instrucciones por unidad de --scale
+static const double BASE_INSTRUCTIONS = 1e8;
+
+static uint64_t iterations(const Workload& w, double scale) {
+  uint64_t n = (uint64_t) (scale * BASE_INSTRUCTIONS / w.body);
+  if (n < 1) n = 1;
+  if (n > 0x7fffffff) n = 0x7fffffff; // contador en un registro de 32 bits
+  return n;
+}
+
+static string source(const Workload& w, uint64_t n) {
+  std::ostringstream out;
+  out << "push " << n << endl << "store 7" << endl;
+  w.gen(out);
+  return out.str();
+}
+
+// Cuenta las reservas de memoria del proceso, para --parse
+static uint64_t allocations = 0;
+
+void* operator new(size_t n) {
+  allocations++;
+  void* p = malloc(n ? n : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Lineas del programa de --parse por unidad de --scale
+static const double PARSE_LINES = 1e6;
+
+// Programa para medir el parser: bloques de 8 lineas con un comentario, un
+// label propio, numeros de varios largos y un salto hacia atras
+static string parseSource(uint64_t lines) {
+  std::ostringstream out;
+  for (uint64_t k=0; k*8 < lines; k++) {
+    out << "% bloque " << k << endl
+	<< "L" << k << ": push " << k * 7919 % 1000000000 << endl
+	<< "load 3" << endl << "add" << endl << "dup" << endl << "store 3" << endl
+	<< "push 100" << endl << "jmplt L" << k << endl;
+  }
+  return out.str();
+}
+
+static double seconds(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// --parse: MB/s del scanner solo (con cada nucleo del indice estructural),
+// de scanner + parser sobre el mismo texto y del parser por pedazos en
+// paralelo, cuantas reservas de memoria hace cada uno por linea, y el tiempo
+// de armar el Program (resolucion de labels)
+static void benchParse(double scale, int repeat, const string& jsonfile) {
+  uint64_t lines = (uint64_t) (scale * PARSE_LINES);
+  if (lines < 8) lines = 8;
+  string src = parseSource(lines);
+  lines = (lines + 7) / 8 * 8;
+  double mb = src.size() / 1e6;
+  cout.precision(3);
+  cout << fixed;
+  cout << "parse input: " << lines << " lines, " << mb << " MB" << endl;
+
+  // el scanner con cada nucleo del indice estructural que tenga la CPU
+  string best = StructuralIndex::kernel();
+  const char* kernels[] = { "avx2", "sse4.2", "scalar" };
+  vector<string> scanKernel;
+  vector<double> scanSecs;
+  vector<uint64_t> scanAllocs;
+  for (int k=0; k < 3; k++) {
+    if (!StructuralIndex::select(kernels[k])) continue;
+    double scan = -1;
+    uint64_t allocs = 0;
+    for (int r=0; r < repeat; r++) {
+      Scanner scanner(src.data(), src.size());
+      uint64_t a0 = allocations;
+      std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      while (scanner.nextToken().type != Token::END)
+	;
+      double secs = seconds(t0);
+      allocs = allocations - a0;
+      if (scan < 0 || secs < scan) scan = secs;
+    }
+    scanKernel.push_back(kernels[k]);
+    scanSecs.push_back(scan);
+    scanAllocs.push_back(allocs);
+    cout << "scan/";
+    cout.width(10);
+    cout << left << kernels[k] << right << scan << " s ";
+    cout.width(9);
+    cout << mb / scan << " MB/s " << (double) allocs / lines << " allocs/line" << endl;
+  }
+  StructuralIndex::select(best);
+
+  double parse = -1;
+  uint64_t parseAllocs = 0;
+  for (int r=0; r < repeat; r++) {
+    Scanner scanner(src.data(), src.size());
+    Parser parser(&scanner);
+    list<Instruction*> sl;
+    uint64_t a0 = allocations;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    parser.parse(sl);
+    double secs = seconds(t0);
+    parseAllocs = allocations - a0;
+    if (parse < 0 || secs < parse) parse = secs;
+    for (list<Instruction*>::iterator it = sl.begin(); it != sl.end(); ++it)
+      delete *it;
+  }
+  cout << "parse/";
+  cout.width(9);
+  cout << left << best << right << parse << " s ";
+  cout.width(9);
+  cout << mb / parse << " MB/s " << (double) parseAllocs / lines << " allocs/line" << endl;
+
+  // parser por pedazos y construccion del Program (resolucion de labels)
+  int nthreads = thread::hardware_concurrency();
+  double parallel = -1, build = -1;
+  for (int r=0; r < repeat; r++) {
+    list<Instruction*> sl;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    Parser::parseParallel(src.data(), src.size(), sl, nthreads);
+    double secs = seconds(t0);
+    if (parallel < 0 || secs < parallel) parallel = secs;
+    t0 = std::chrono::steady_clock::now();
+    Program* prog = new Program(sl);
+    secs = seconds(t0);
+    if (build < 0 || secs < build) build = secs;
+    delete prog;
+    for (list<Instruction*>::iterator it = sl.begin(); it != sl.end(); ++it)
+      delete *it;
+  }
+  cout << "parse/" << nthreads << " threads ";
+  cout << parallel << " s ";
+  cout.width(9);
+  cout << mb / parallel << " MB/s" << endl;
+  cout << "program        " << build << " s" << endl;
+
+  std::ofstream json(jsonfile.c_str());
+  json.precision(6);
+  json << "{" << endl;
+  json << "  \"scale\": " << scale << "," << endl;
+  json << "  \"repeat\": " << repeat << "," << endl;
+  json << "  \"parse\": { \"lines\": " << lines << ", \"bytes\": " << src.size()
+       << ", \"kernel\": \"" << best << "\""
+       << ", \"parse_seconds\": " << parse << ", \"parse_mb_per_second\": " << mb / parse
+       << ", \"parse_allocations\": " << parseAllocs
+       << ", \"threads\": " << nthreads << ", \"parallel_seconds\": " << parallel
+       << ", \"parallel_mb_per_second\": " << mb / parallel
+       << ", \"program_seconds\": " << build << " }," << endl;
+  json << "  \"scan\": [" << endl;
+  for (int k=0; k < scanKernel.size(); k++)
+    json << "    { \"kernel\": \"" << scanKernel[k] << "\", \"seconds\": " << scanSecs[k]
+	 << ", \"mb_per_second\": " << mb / scanSecs[k] << ", \"allocations\": " << scanAllocs[k]
+	 << " }" << (k+1 < scanKernel.size() ? "," : "") << endl;
+  json << "  ]" << endl;
+  json << "}" << endl;
+  cout << "Results written to " << jsonfile << endl;
+}
+
+static long maxRSS() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss; // KB en Linux
+}
+
+struct Result {
+  string workload, engine;
+  uint64_t instructions;
+  double seconds;
+  long rss;
+};
+
+static void usage() {
+  cout << "usage: svm_bench [--scale=X] [--engine=NAME|all] [--repeat=N] [--json=FILE] [--dump=DIR] [--list] [--parse] [workload...]" << endl;
+  exit(1);
+}
+
+int main(int argc, const char* argv[]) {
+  double scale = 1;
+  int repeat = 1;
+  string jsonfile = "bench.json", dumpdir;
+  vector<SVM::Engine> engines;
+  vector<int> selected;
+  bool parseOnly = false;
+
+  for (int i=1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.compare(0, 8, "--scale=") == 0) {
+      scale = atof(arg.c_str()+8);
+      if (scale <= 0) usage();
+    } else if (arg.compare(0, 9, "--repeat=") == 0) {
+      repeat = atoi(arg.c_str()+9);
+      if (repeat <= 0) usage();
+    } else if (arg.compare(0, 9, "--engine=") == 0) {
+      SVM::Engine e;
+      if (arg.substr(9) == "all") {
+	for (int k=0; k < 6; k++) engines.push_back((SVM::Engine) k);
+      } else if (SVM::engineFromName(arg.substr(9), e))
+	engines.push_back(e);
+      else {
+	cout << "Unknown engine " << arg.substr(9) << " (classic, switch, goto, threaded, register, jit, all)" << endl;
+	exit(1);
+      }
+    } else if (arg.compare(0, 7, "--json=") == 0) {
+      jsonfile = arg.substr(7);
+    } else if (arg.compare(0, 7, "--dump=") == 0) {
+      dumpdir = arg.substr(7);
+    } else if (arg == "--parse") {
+      parseOnly = true;
+    } else if (arg == "--list") {
+      for (int k=0; k < NUM_WORKLOADS; k++)
+	cout << workloads[k].name << ": " << workloads[k].description << endl;
+      exit(0);
+    } else {
+      int k = 0;
+      while (k < NUM_WORKLOADS && arg != workloads[k].name) k++;
+      if (k == NUM_WORKLOADS) usage();
+      selected.push_back(k);
+    }
+  }
+  if (parseOnly) {
+    benchParse(scale, repeat, jsonfile);
+    return 0;
+  }
+  if (engines.empty()) engines.push_back(SVM::ENGINE_THREADED);
+  if (selected.empty())
+    for (int k=0; k < NUM_WORKLOADS; k++) selected.push_back(k);
+
+  vector<Result> results;
+  cout.precision(3);
+  cout << fixed;
+  for (int s=0; s < selected.size(); s++) {
+    const Workload& w = workloads[selected[s]];
+    uint64_t n = iterations(w, scale);
+    string src = source(w, n);
+    if (dumpdir != "") {
+      std::ofstream dout((dumpdir + "/" + w.name + ".svm").c_str());
+      dout << src;
+    }
+    Scanner scanner(src);
+    Parser parser(&scanner);
+    list<Instruction*> sl;
+    parser.parse(sl);
+    for (int e=0; e < engines.size(); e++) {
+      double best = -1;
+      for (int r=0; r < repeat; r++) {
+	SVM svm(sl);
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	svm.execute(engines[e]);
+	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+	double secs = std::chrono::duration<double>(t1 - t0).count();
+	if (best < 0 || secs < best) best = secs;
+      }
+      Result res;
+      res.workload = w.name;
+      res.engine = SVM::engine_names[engines[e]];
+      res.instructions = w.prologue + n * w.body;
+      res.seconds = best;
+      res.rss = maxRSS();
+      results.push_back(res);
+      cout.width(10);
+      cout << left << res.workload;
+      cout.width(10);
+      cout << res.engine << right;
+      cout.width(14);
+      cout << res.instructions << " instr";
+      cout.width(10);
+      cout << res.seconds << " s";
+      cout.width(10);
+      cout << res.instructions / res.seconds / 1e6 << " Minstr/s";
+      cout.width(8);
+      cout << res.rss / 1024 << " MB" << endl;
+    }
+  }
+
+  std::ofstream json(jsonfile.c_str());
+  json.precision(6);
+  json << "{" << endl;
+  json << "  \"scale\": " << scale << "," << endl;
+  json << "  \"repeat\": " << repeat << "," << endl;
+  json << "  \"results\": [" << endl;
+  for (int k=0; k < results.size(); k++) {
+    const Result& r = results[k];
+    json << "    { \"workload\": \"" << r.workload << "\", \"engine\": \"" << r.engine
+	 << "\", \"instructions\": " << r.instructions << ", \"seconds\": " << r.seconds
+	 << ", \"instructions_per_second\": " << (uint64_t) (r.instructions / r.seconds)
+	 << ", \"max_rss_kb\": " << r.rss << " }" << (k+1 < results.size() ? "," : "") << endl;
+  }
+  json << "  ]" << endl;
+  json << "}" << endl;
+  cout << "Results written to " << jsonfile << endl;
+}
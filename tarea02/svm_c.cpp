@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+
+#include "svm.hh"
+
+/* ******** Traduccion a C (svm2c) *********** */
+
+// Genera un programa C equivalente: cada instruccion con label es un label
+// de C (L_nombre), los saltos son goto y la pila es un arreglo local
+// indexado con la altura conocida por verify(). La salida del programa
+// generado es la misma que la de execute(): una linea "stack [ ... ]" por
+// cada print y una al terminar. La division revisa lo mismo que
+// ExecutionContext::divide y termina con el mismo mensaje.
+void Program::emit_c(ostream& out) const {
+  side();
+  int n = code.size();
+  out << "/* generado por svm --svm2c */" << endl;
+  out << "#include <stdio.h>" << endl;
+  out << "#include <stdlib.h>" << endl;
+  out << "#include <limits.h>" << endl << endl;
+  out << "static void print_stack(const int* s, int h) {" << endl;
+  out << "  int i;" << endl;
+  out << "  printf(\"stack [ \");" << endl;
+  out << "  for (i = h-1; i >= 0; i--) printf(\"%d \", s[i]);" << endl;
+  out << "  printf(\"]\\n\");" << endl;
+  out << "}" << endl << endl;
+  out << "static int divide(int a, int b) {" << endl;
+  out << "  if (b == 0 || (a == INT_MIN && b == -1)) {" << endl;
+  out << "    printf(\"error: Division by zero\\n\");" << endl;
+  out << "    exit(1);" << endl;
+  out << "  }" << endl;
+  out << "  return a / b;" << endl;
+  out << "}" << endl << endl;
+  out << "int main(void) {" << endl;
+  out << "  int s[" << (maxheight > 0 ? maxheight : 1) << "];" << endl;
+  out << "  int r[8] = { 0 };" << endl;
+  for (int i=0; i < n; i++) {
+    int h = height[i];
+    if (h == -1) continue;
+    const string& l = instructions[i]->label;
+    if (l != "")
+      out << " L_" << l << ":" << endl;
+    const Code& c = code[i];
+    string top = "s[" + to_string(h-1) + "]", next = "s[" + to_string(h-2) + "]";
+    string utop = "(unsigned) " + top, unext = "(unsigned) " + next;
+    out << "  ";
+    switch (c.op) {
+    case Instruction::IPUSH: out << "s[" << h << "] = " << c.arg << ";"; break;
+    case Instruction::IPOP: out << ";"; break;
+    case Instruction::IDUP: out << "s[" << h << "] = " << top << ";"; break;
+    case Instruction::ISWAP:
+      out << "{ int t = " << top << "; " << top << " = " << next << "; " << next << " = t; }"; break;
+    case Instruction::IADD: out << next << " = (int) (" << unext << " + " << utop << ");"; break;
+    case Instruction::ISUB: out << next << " = (int) (" << unext << " - " << utop << ");"; break;
+    case Instruction::IMUL: out << next << " = (int) (" << unext << " * " << utop << ");"; break;
+    case Instruction::IDIV: out << next << " = divide(" << next << ", " << top << ");"; break;
+    case Instruction::IGOTO: out << "goto L_" << instructions[i]->jmplabel << ";"; break;
+    case Instruction::IJMPEQ: case Instruction::IJMPGT: case Instruction::IJMPGE:
+    case Instruction::IJMPLT: case Instruction::IJMPLE: {
+      static const char* rel[5] = { "==", ">", ">=", "<", "<=" };
+      out << "if (" << next << " " << rel[c.op - Instruction::IJMPEQ] << " " << top << ") goto L_" << instructions[i]->jmplabel << ";";
+      break;
+    }
+    case Instruction::ISKIP: out << ";"; break;
+    case Instruction::ISTORE: out << "r[" << c.arg << "] = " << top << ";"; break;
+    case Instruction::ILOAD: out << "s[" << h << "] = r[" << c.arg << "];"; break;
+    case Instruction::IPRINT: out << "print_stack(s, " << h << ");"; break;
+    }
+    out << " /* " << snames[c.op];
+    if (instructions[i]->hasarg) {
+      if (instructions[i]->jmplabel == "") out << " " << c.arg;
+      else out << " " << instructions[i]->jmplabel;
+    }
+    out << " */" << endl;
+  }
+  out << "  print_stack(s, " << (exitheight > 0 ? exitheight : 0) << ");" << endl;
+  out << "  (void) r;" << endl;
+  out << "  return 0;" << endl;
+  out << "}" << endl;
+}
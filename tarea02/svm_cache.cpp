@@ -0,0 +1,113 @@
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "svm_cache.hh"
+#include "svm_image.hh"
+
+/* ******** Cache de imagenes (--cache) *********** */
+
+static bool isCacheFile(const string& name) {
+  return name.size() > 5 && name.compare(name.size()-5, 5, ".svbc") == 0;
+}
+
+ImageCache::ImageCache(const string& d, uint64_t max):dir(d),maxbytes(max),used(0) {
+  mkdir(dir.c_str(), 0777); // puede existir
+  DIR* dp = opendir(dir.c_str());
+  if (dp == NULL) return;
+  struct dirent* e;
+  while ((e = readdir(dp)) != NULL) {
+    struct stat st;
+    if (isCacheFile(e->d_name) && stat((dir + "/" + e->d_name).c_str(), &st) == 0)
+      used += st.st_size;
+  }
+  closedir(dp);
+}
+
+// La version de la imagen entra en la clave: al cambiar el formato las
+// entradas viejas simplemente dejan de encontrarse (y se van por LRU)
+string ImageCache::key(const char* source, size_t n, uint32_t options) const {
+  uint32_t tag[2] = { Image::VERSION, options };
+  uint64_t h = fnv1a(tag, sizeof(tag));
+  h = fnv1a(source, n, h);
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%016llx-%llx", (unsigned long long) h, (unsigned long long) n);
+  return buf;
+}
+
+string ImageCache::path(const string& key) const {
+  return dir + "/" + key + ".svbc";
+}
+
+Program* ImageCache::lookup(const string& key) {
+  string p = path(key);
+  if (access(p.c_str(), R_OK) != 0) return NULL;
+  try {
+    Program* prog = Image::load(p);
+    utimensat(AT_FDCWD, p.c_str(), NULL, 0); // usada ahora
+    return prog;
+  } catch (SVMError& e) {
+    unlink(p.c_str());
+    return NULL;
+  }
+}
+
+void ImageCache::store(const string& key, const Program& prog) {
+  string p = path(key);
+  // temporal unico por proceso e hilo, en el mismo directorio que el destino
+  string tmp = p + ".tmp." + to_string(getpid()) + "." + to_string(hash<thread::id>()(this_thread::get_id()));
+  std::ofstream out(tmp.c_str(), ios::binary);
+  Image::write(prog, out);
+  out.close();
+  struct stat st;
+  if (!out || stat(tmp.c_str(), &st) != 0 || rename(tmp.c_str(), p.c_str()) != 0) {
+    unlink(tmp.c_str()); // sin cache el programa igual corre
+    return;
+  }
+  lock_guard<mutex> lock(m);
+  used += st.st_size;
+  if (used > maxbytes) evict();
+}
+
+struct CacheEntry {
+  string name;
+  struct timespec mtime;
+  uint64_t size;
+  bool operator<(const CacheEntry& o) const {
+    if (mtime.tv_sec != o.mtime.tv_sec) return mtime.tv_sec < o.mtime.tv_sec;
+    return mtime.tv_nsec < o.mtime.tv_nsec;
+  }
+};
+
+// Borra las entradas menos usadas hasta bajar a 3/4 de maxbytes, para no
+// recorrer el directorio en cada store()
+void ImageCache::evict() {
+  vector<CacheEntry> entries;
+  used = 0;
+  DIR* dp = opendir(dir.c_str());
+  if (dp == NULL) return;
+  struct dirent* e;
+  while ((e = readdir(dp)) != NULL) {
+    struct stat st;
+    if (!isCacheFile(e->d_name) || stat((dir + "/" + e->d_name).c_str(), &st) != 0) continue;
+    CacheEntry ce;
+    ce.name = e->d_name;
+    ce.mtime = st.st_mtim;
+    ce.size = st.st_size;
+    entries.push_back(ce);
+    used += st.st_size;
+  }
+  closedir(dp);
+  sort(entries.begin(), entries.end());
+  for (int i=0; i < entries.size() && used > maxbytes / 4 * 3; i++) {
+    unlink((dir + "/" + entries[i].name).c_str()); // otro proceso pudo borrarla antes
+    used -= entries[i].size;
+  }
+}
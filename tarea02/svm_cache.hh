@@ -0,0 +1,39 @@
+#ifndef SVM_CACHE
+#define SVM_CACHE
+
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+#include "svm.hh"
+
+using namespace std;
+
+
+// Cache en disco de imagenes (.svbc) ya verificadas y optimizadas. La clave
+// es un hash del texto fuente y de las opciones que cambian la imagen, asi
+// que un programa que no cambio se carga sin parser ni optimizador. Se
+// escribe en un temporal y se publica con rename(2), de modo que varios
+// procesos o hilos pueden compartir el directorio. Cuando el directorio
+// pasa de maxbytes se borran las imagenes usadas hace mas tiempo (cada
+// acierto actualiza la fecha de modificacion del archivo).
+class ImageCache {
+  string dir;
+  uint64_t maxbytes;
+  uint64_t used; // estimado; evict() lo recalcula
+  mutex m;
+  void evict();
+public:
+  static const uint64_t DEFAULT_SIZE = 64 << 20;
+  // Opciones que cambian la imagen (se combinan con |)
+  enum { OPTIMIZE = 1, OPEN_REGISTERS = 2 }; // -O; -O con --sweep (registros abiertos)
+  ImageCache(const string& dir, uint64_t maxbytes = DEFAULT_SIZE);
+  string key(const char* source, size_t n, uint32_t options) const;
+  string path(const string& key) const;
+  // NULL si no esta (una imagen danada cuenta como ausente y se borra)
+  Program* lookup(const string& key);
+  void store(const string& key, const Program& prog);
+};
+
+
+#endif
@@ -0,0 +1,219 @@
+#include <iostream>
+
+#include "svm_cfg.hh"
+
+CFG::CFG(list<Instruction*>& sl) {
+  prog.assign(sl.begin(), sl.end());
+  build();
+}
+
+void CFG::build() {
+  int n = prog.size();
+  labels.clear();
+  for (int i=0; i < n; i++)
+    if (prog[i]->label != "") labels[prog[i]->label] = i;
+  // lideres
+  vector<bool> leader(n+1, false);
+  leader[0] = true;
+  for (int i=0; i < n; i++) {
+    if (!isJump(prog[i]->type)) continue;
+    leader[i+1] = true;
+    unordered_map<string,int>::const_iterator it = labels.find(prog[i]->jmplabel);
+    if (it != labels.end()) leader[it->second] = true;
+  }
+  blocks.clear();
+  blockOf.assign(n, -1);
+  for (int i=0; i < n; i++) {
+    if (leader[i]) {
+      BasicBlock b;
+      b.id = blocks.size();
+      b.first = i;
+      blocks.push_back(b);
+    }
+    blocks.back().last = i;
+    blockOf[i] = blocks.back().id;
+  }
+  // aristas
+  for (int k=0; k < blocks.size(); k++) {
+    BasicBlock& b = blocks[k];
+    Instruction* s = prog[b.last];
+    b.target = -1;
+    if (isJump(s->type)) {
+      unordered_map<string,int>::const_iterator it = labels.find(s->jmplabel);
+      if (it != labels.end()) b.target = blockOf[it->second];
+    }
+    if (s->type == Instruction::IGOTO)
+      b.fallthrough = -1;
+    else
+      b.fallthrough = (k+1 < blocks.size()) ? k+1 : BasicBlock::EXIT;
+    if (b.target >= 0) b.succs.push_back(b.target);
+    if (b.fallthrough >= 0 && b.fallthrough != b.target) b.succs.push_back(b.fallthrough);
+  }
+  for (int k=0; k < blocks.size(); k++)
+    for (int j=0; j < blocks[k].succs.size(); j++)
+      blocks[blocks[k].succs[j]].preds.push_back(k);
+  // alcanzabilidad desde el bloque de entrada
+  for (int k=0; k < blocks.size(); k++) blocks[k].reachable = false;
+  vector<int> work;
+  if (!blocks.empty()) {
+    blocks[0].reachable = true;
+    work.push_back(0);
+  }
+  while (!work.empty()) {
+    int k = work.back(); work.pop_back();
+    for (int j=0; j < blocks[k].succs.size(); j++) {
+      int s = blocks[k].succs[j];
+      if (!blocks[s].reachable) {
+	blocks[s].reachable = true;
+	work.push_back(s);
+      }
+    }
+  }
+}
+
+// Elimina los bloques a los que no se llega desde la entrada
+int CFG::removeUnreachable() {
+  vector<Instruction*> out;
+  int removed = 0;
+  for (int i=0; i < prog.size(); i++) {
+    if (blocks[blockOf[i]].reachable)
+      out.push_back(prog[i]);
+    else {
+      delete prog[i];
+      removed++;
+    }
+  }
+  if (removed > 0) {
+    prog.swap(out);
+    build();
+  }
+  return removed;
+}
+
+string CFG::newLabel(int b) {
+  string l = "_B" + to_string(b);
+  while (labels.count(l)) l += "_";
+  labels[l] = blocks[b].first;
+  return l;
+}
+
+static int invertJump(int op) {
+  switch (op) {
+  case Instruction::IJMPGT: return Instruction::IJMPLE;
+  case Instruction::IJMPGE: return Instruction::IJMPLT;
+  case Instruction::IJMPLT: return Instruction::IJMPGE;
+  case Instruction::IJMPLE: return Instruction::IJMPGT;
+  default: return -1; // no hay jmpne
+  }
+}
+
+// Reordena los bloques para que el camino comun sea el que cae: el destino
+// de un goto se coloca a continuacion (y el goto desaparece), y si el bloque
+// que cae ya fue colocado se invierte la condicion del salto. Los cambios de
+// orden que rompen una caida se corrigen con un goto explicito.
+void CFG::reorder() {
+  int nb = blocks.size();
+  if (nb == 0) return;
+  vector<int> order;
+  vector<bool> placed(nb, false), invert(nb, false);
+  for (int start=0; start < nb; start++) {
+    int k = start;
+    while (k != -1 && !placed[k]) {
+      placed[k] = true;
+      order.push_back(k);
+      BasicBlock& b = blocks[k];
+      int op = prog[b.last]->type;
+      int next = -1;
+      if (b.fallthrough >= 0) {
+	if (!placed[b.fallthrough])
+	  next = b.fallthrough;
+	else if (isCondJump(op) && b.target >= 0 && !placed[b.target] && invertJump(op) != -1) {
+	  invert[k] = true;
+	  next = b.target;
+	}
+      } else if (op == Instruction::IGOTO && b.target >= 0 && !placed[b.target])
+	next = b.target;
+      k = next;
+    }
+  }
+  vector<Instruction*> out;
+  string endlabel;
+  for (int p=0; p < order.size(); p++) {
+    BasicBlock& b = blocks[order[p]];
+    int nextb = (p+1 < order.size()) ? order[p+1] : -1;
+    for (int i=b.first; i <= b.last; i++)
+      out.push_back(prog[i]);
+    Instruction* s = prog[b.last];
+    int ft = b.fallthrough;
+    if (invert[order[p]]) {
+      string fl = prog[blocks[ft].first]->label;
+      if (fl == "") fl = prog[blocks[ft].first]->label = newLabel(ft);
+      s->type = (Instruction::IType) invertJump(s->type);
+      s->jmplabel = fl;
+      ft = b.target;
+    }
+    if (ft == -1) {
+      if (b.target >= 0 && b.target == nextb) { // goto al bloque siguiente
+	if (s->label == "") {
+	  out.pop_back();
+	  delete s;
+	} else { // el label sigue siendo destino: queda un skip
+	  s->type = Instruction::ISKIP;
+	  s->hasarg = false;
+	  s->jmplabel = "";
+	}
+      }
+    } else if (ft == BasicBlock::EXIT) {
+      if (nextb != -1) {
+	if (endlabel == "") {
+	  endlabel = "_END";
+	  while (labels.count(endlabel)) endlabel += "_";
+	}
+	out.push_back(new Instruction("", Instruction::IGOTO, endlabel));
+      }
+    } else if (ft != nextb) {
+      string fl = prog[blocks[ft].first]->label;
+      if (fl == "") fl = prog[blocks[ft].first]->label = newLabel(ft);
+      out.push_back(new Instruction("", Instruction::IGOTO, fl));
+    }
+  }
+  if (endlabel != "")
+    out.push_back(new Instruction(endlabel, Instruction::ISKIP));
+  prog.swap(out);
+  build();
+}
+
+static string instrText(Instruction* s) {
+  string t = snames[s->type];
+  if (s->hasarg)
+    t += " " + (s->jmplabel == "" ? to_string(s->argint) : s->jmplabel);
+  return t;
+}
+
+// Salida en formato Graphviz (dot -Tpng)
+void CFG::dot(ostream& out) {
+  out << "digraph cfg {" << endl;
+  out << "  node [shape=box, fontname=\"monospace\"];" << endl;
+  for (int k=0; k < blocks.size(); k++) {
+    BasicBlock& b = blocks[k];
+    out << "  B" << k << " [label=\"B" << k << "\\l";
+    for (int i=b.first; i <= b.last; i++) {
+      if (prog[i]->label != "") out << prog[i]->label << ": ";
+      out << instrText(prog[i]) << "\\l";
+    }
+    out << "\"";
+    if (!b.reachable) out << ", style=dashed";
+    out << "];" << endl;
+    if (b.target >= 0)
+      out << "  B" << k << " -> B" << b.target << " [label=\"" << (prog[b.last]->type == Instruction::IGOTO ? "goto" : "T") << "\"];" << endl;
+    if (b.fallthrough >= 0 && b.fallthrough != b.target)
+      out << "  B" << k << " -> B" << b.fallthrough << (isCondJump(prog[b.last]->type) ? " [label=\"F\"]" : "") << ";" << endl;
+    if (b.fallthrough == BasicBlock::EXIT)
+      out << "  B" << k << " -> EXIT;" << endl;
+  }
+  out << "}" << endl;
+}
+
+void CFG::toList(list<Instruction*>& sl) {
+  sl.assign(prog.begin(), prog.end());
+}
@@ -0,0 +1,50 @@
+#ifndef SVM_CFG
+#define SVM_CFG
+
+#include <string>
+#include <list>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+
+#include "svm.hh"
+
+using namespace std;
+
+
+// Bloque basico: instrucciones [first, last] del programa
+class BasicBlock {
+public:
+  int id;
+  int first, last;
+  int target;      // bloque destino del salto final, -1 si no termina en salto
+  int fallthrough; // bloque al que se cae, -1 si termina en goto, EXIT si sale
+  vector<int> succs, preds;
+  bool reachable;
+  static const int EXIT = -2;
+  BasicBlock():id(0),first(0),last(-1),target(-1),fallthrough(-1),reachable(false) { }
+};
+
+
+// Grafo de control de un programa SVM (a nivel de labels, antes de
+// construir el SVM). Los lideres son el inicio, los destinos de salto y las
+// instrucciones que siguen a un salto.
+class CFG {
+private:
+  vector<Instruction*> prog;
+  unordered_map<string,int> labels; // label -> instruccion
+  string newLabel(int b);
+public:
+  vector<BasicBlock> blocks;
+  vector<int> blockOf; // instruccion -> bloque
+  CFG(list<Instruction*>& sl);
+  Instruction* instruction(int i) { return prog[i]; }
+  void build();
+  int removeUnreachable();
+  void reorder();
+  void dot(ostream& out);
+  void toList(list<Instruction*>& sl);
+};
+
+
+#endif
@@ -0,0 +1,126 @@
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "svm_image.hh"
+#include "svm_source.hh"
+
+/* ******** Imagen binaria (.svbc) *********** */
+
+static const char MAGIC[4] = { 'S', 'V', 'B', 'C' };
+
+// Se guarda code (sin superinstrucciones): fuse() es lineal y la imagen no
+// depende de como se fusiona en cada version.
+void Image::write(const Program& prog, ostream& out) {
+  prog.side();
+  int n = prog.code.size();
+  // copia con el relleno de Code en 0: la misma fuente da la misma imagen
+  vector<Code> code(n);
+  memset(code.data(), 0, n * sizeof(Code));
+  for (int i=0; i < n; i++) {
+    code[i].op = prog.code[i].op;
+    code[i].arg = prog.code[i].arg;
+  }
+  vector<ImageNames> names(n);
+  string strings;
+  unordered_map<string,int> offset;
+  for (int i=0; i < n; i++) {
+    const Instruction* s = prog.instructions[i];
+    string l[2] = { s->label, isJump(prog.code[i].op) ? s->jmplabel : "" };
+    int32_t* dst[2] = { &names[i].label, &names[i].jmplabel };
+    for (int k=0; k < 2; k++) {
+      if (l[k] == "") {
+	*dst[k] = -1;
+	continue;
+      }
+      unordered_map<string,int>::iterator it = offset.find(l[k]);
+      if (it == offset.end()) {
+	it = offset.insert(make_pair(l[k], (int) strings.size())).first;
+	strings.append(l[k].c_str(), l[k].size() + 1);
+      }
+      *dst[k] = it->second;
+    }
+  }
+  ImageHeader h;
+  memcpy(h.magic, MAGIC, 4);
+  h.version = VERSION;
+  h.ninstr = n;
+  h.strsize = strings.size();
+  h.checksum = fnv1a(code.data(), n * sizeof(Code));
+  h.checksum = fnv1a(names.data(), n * sizeof(ImageNames), h.checksum);
+  h.checksum = fnv1a(strings.data(), strings.size(), h.checksum);
+  out.write((const char*) &h, sizeof(h));
+  out.write((const char*) code.data(), n * sizeof(Code));
+  out.write((const char*) names.data(), n * sizeof(ImageNames));
+  out.write(strings.data(), strings.size());
+}
+
+bool Image::isImage(const string& fname) {
+  char magic[4];
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool is = read(fd, magic, 4) == 4 && memcmp(magic, MAGIC, 4) == 0;
+  close(fd);
+  return is;
+}
+
+Program* Image::load(const string& fname) {
+  MappedFile m; // se libera tambien si la validacion lanza una excepcion
+  if (!m.open(fname))
+    throw SVMError("error: Can't read " + fname);
+  if (m.size() < sizeof(ImageHeader))
+    throw SVMError("error: " + fname + ": truncated image");
+
+  // encabezado y tamanos antes de tocar el resto
+  const ImageHeader* h = (const ImageHeader*) m.data();
+  if (memcmp(h->magic, MAGIC, 4) != 0)
+    throw SVMError("error: " + fname + ": not an SVM image");
+  if (h->version != VERSION)
+    throw SVMError("error: " + fname + ": unsupported image version " + to_string(h->version));
+  uint64_t n = h->ninstr;
+  uint64_t body = n * (sizeof(Code) + sizeof(ImageNames)) + h->strsize;
+  if (sizeof(ImageHeader) + body != m.size())
+    throw SVMError("error: " + fname + ": truncated image");
+  const char* payload = m.data() + sizeof(ImageHeader);
+  if (fnv1a(payload, body) != h->checksum)
+    throw SVMError("error: " + fname + ": checksum mismatch");
+  const Code* code = (const Code*) payload;
+  const ImageNames* names = (const ImageNames*) (payload + n * sizeof(Code));
+  const char* strings = payload + n * (sizeof(Code) + sizeof(ImageNames));
+  if (h->strsize > 0 && strings[h->strsize-1] != 0)
+    throw SVMError("error: " + fname + ": bad string table");
+
+  // el checksum solo detecta corrupcion: lo que verify() da por sentado
+  // (opcodes y destinos validos: el parser nunca salta a n, y el motor goto
+  // no tiene una entrada despues de la ultima) y que no haya labels repetidos (las
+  // cadenas estan internadas: un label repetido es un desplazamiento
+  // repetido) se comprueba aqui
+  vector<bool> defined(h->strsize);
+  for (int i=0; i < n; i++) {
+    const Code& c = code[i];
+    const ImageNames& nm = names[i];
+    if (c.op > Instruction::IPRINT || c.reg != 0)
+      throw SVMError("error: " + fname + ": bad opcode at instruction " + to_string(i));
+    if (isJump(c.op) && (c.arg < 0 || c.arg >= n))
+      throw SVMError("error: " + fname + ": bad jump target at instruction " + to_string(i));
+    if (nm.label < -1 || nm.label >= (int64_t) h->strsize || nm.jmplabel < -1 || nm.jmplabel >= (int64_t) h->strsize)
+      throw SVMError("error: " + fname + ": bad label at instruction " + to_string(i));
+    if (nm.label >= 0) {
+      if (defined[nm.label])
+	throw SVMError("error: " + fname + ": duplicate label at instruction " + to_string(i));
+      defined[nm.label] = true;
+    }
+  }
+  Program* prog = new Program();
+  prog->code.assign(code, code + n);
+  prog->imagenames.assign((const int32_t*) names, (const int32_t*) (names + n));
+  prog->imagestrings.assign(strings, h->strsize);
+  try {
+    prog->verify();
+    prog->fuse();
+  } catch (SVMError& e) {
+    delete prog;
+    throw;
+  }
+  return prog;
+}
@@ -0,0 +1,56 @@
+#ifndef SVM_IMAGE
+#define SVM_IMAGE
+
+#include <string>
+#include <iostream>
+#include <cstdint>
+
+#include "svm.hh"
+
+using namespace std;
+
+
+// FNV-1a de 64 bits
+inline uint64_t fnv1a(const void* data, size_t n, uint64_t h = 14695981039346656037ULL) {
+  const unsigned char* p = (const unsigned char*) data;
+  for (size_t i=0; i < n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Imagen binaria de un programa ya resuelto (.svbc). Despues del
+// encabezado vienen, sin relleno:
+//   Code code[ninstr]           saltos con el indice de destino
+//   ImageNames names[ninstr]    labels de cada instruccion (para print y errores)
+//   char strings[strsize]       cadenas terminadas en 0
+// El checksum cubre todo lo que sigue al encabezado. La imagen usa el orden
+// de bytes de la maquina que la genero.
+struct ImageHeader {
+  char magic[4]; // "SVBC"
+  uint32_t version;
+  uint32_t ninstr;
+  uint32_t strsize;
+  uint64_t checksum;
+};
+
+struct ImageNames {
+  int32_t label, jmplabel; // posicion en strings, -1: sin label
+};
+
+static_assert(sizeof(ImageHeader) == 24, "ImageHeader debe ocupar 24 bytes");
+
+class Image {
+public:
+  static const uint32_t VERSION = 1;
+  static void write(const Program& prog, ostream& out);
+  // Verdadero si el archivo empieza con la marca de una imagen
+  static bool isImage(const string& fname);
+  // Mapea la imagen (mmap), la valida y arma el Program sin pasar por el
+  // parser ni resolver labels. Lanza SVMError si la imagen no es valida.
+  static Program* load(const string& fname);
+};
+
+
+#endif
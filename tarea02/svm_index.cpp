@@ -0,0 +1,148 @@
+#include <cstring>
+
+#include "svm_index.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SVM_X86
+#endif
+
+/* ******** Indice estructural *********** */
+
+static inline bool isWordChar(unsigned char c) {
+  return (unsigned) ((c | 0x20) - 'a') < 26 || (unsigned) (c - '0') < 10 || c == '_';
+}
+
+// Cada nucleo clasifica nwords * 64 bytes y escribe un uint64_t por cada 64
+// (bit i: el byte i es delimitador)
+typedef void (*ClassifyFn)(const char* p, int nwords, uint64_t* bits);
+
+static void classifyScalar(const char* p, int nwords, uint64_t* bits) {
+  for (int w=0; w < nwords; w++, p += 64) {
+    uint64_t m = 0;
+    for (int i=0; i < 64; i++)
+      m |= (uint64_t) !isWordChar(p[i]) << i;
+    bits[w] = m;
+  }
+}
+
+#ifdef SVM_X86
+
+// pcmpestrm en modo rangos: marca los bytes en a-z, A-Z, 0-9 o _
+__attribute__((target("sse4.2")))
+static void classifySSE42(const char* p, int nwords, uint64_t* bits) {
+  const __m128i ranges = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9', '_', '_', 0, 0, 0, 0, 0, 0, 0, 0);
+  for (int w=0; w < nwords; w++, p += 64) {
+    uint64_t m = 0;
+    for (int k=0; k < 4; k++) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (p + 16*k));
+      __m128i word = _mm_cmpestrm(ranges, 8, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_BIT_MASK);
+      m |= (uint64_t) (~_mm_cvtsi128_si32(word) & 0xffff) << (16*k);
+    }
+    bits[w] = m;
+  }
+}
+
+// Comparaciones con signo: los bytes >= 0x80 quedan negativos y no caen en
+// ningun rango. c | 0x20 lleva las mayusculas a minusculas.
+__attribute__((target("avx2")))
+static void classifyAVX2(const char* p, int nwords, uint64_t* bits) {
+  const __m256i lowerBit = _mm256_set1_epi8(0x20);
+  const __m256i aMinus = _mm256_set1_epi8('a' - 1), zPlus = _mm256_set1_epi8('z' + 1);
+  const __m256i d0Minus = _mm256_set1_epi8('0' - 1), d9Plus = _mm256_set1_epi8('9' + 1);
+  const __m256i under = _mm256_set1_epi8('_');
+  for (int w=0; w < nwords; w++, p += 64) {
+    uint64_t m = 0;
+    for (int k=0; k < 2; k++) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (p + 32*k));
+      __m256i l = _mm256_or_si256(v, lowerBit);
+      __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, aMinus), _mm256_cmpgt_epi8(zPlus, l));
+      __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, d0Minus), _mm256_cmpgt_epi8(d9Plus, v));
+      __m256i word = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_cmpeq_epi8(v, under));
+      m |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(word) << (32*k);
+    }
+    bits[w] = m;
+  }
+}
+
+#endif
+
+struct Kernel {
+  const char* name;
+  ClassifyFn fn;
+  bool (*supported)();
+};
+
+static bool always() { return true; }
+#ifdef SVM_X86
+static bool hasSSE42() { return __builtin_cpu_supports("sse4.2"); }
+static bool hasAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+
+// En orden de preferencia
+static const Kernel kernels[] = {
+#ifdef SVM_X86
+  { "avx2", classifyAVX2, hasAVX2 },
+  { "sse4.2", classifySSE42, hasSSE42 },
+#endif
+  { "scalar", classifyScalar, always },
+};
+static const int NUM_KERNELS = sizeof(kernels) / sizeof(kernels[0]);
+
+static const Kernel* pickKernel() {
+  int k = 0;
+  while (!kernels[k].supported()) k++; // scalar siempre esta
+  return &kernels[k];
+}
+
+static const Kernel* current = pickKernel();
+
+const char* StructuralIndex::kernel() {
+  return current->name;
+}
+
+bool StructuralIndex::select(const string& name) {
+  for (int k=0; k < NUM_KERNELS; k++)
+    if (name == kernels[k].name && kernels[k].supported()) {
+      current = &kernels[k];
+      return true;
+    }
+  return false;
+}
+
+StructuralIndex::StructuralIndex(const char* t, int n):text(t),len(n),base(-1) { }
+
+// Los bytes despues del fin del texto cuentan como delimitadores; el ultimo
+// pedazo de menos de 64 bytes se clasifica aparte para no leer fuera de text
+void StructuralIndex::build(int b) {
+  base = b;
+  int n = len - b < BLOCK ? len - b : BLOCK;
+  int full = n / 64;
+  current->fn(text + b, full, bits);
+  int w = full;
+  if (n % 64 != 0) {
+    uint64_t m = ~0ULL;
+    for (int i=0; i < n % 64; i++)
+      if (isWordChar(text[b + 64*full + i])) m &= ~(1ULL << i);
+    bits[w++] = m;
+  }
+  for (; w < WORDS; w++)
+    bits[w] = ~0ULL;
+}
+
+int StructuralIndex::next(int pos) {
+  while (pos < len) {
+    if (base < 0 || pos < base || pos >= base + BLOCK)
+      build(pos & ~63);
+    int i = (pos - base) >> 6;
+    uint64_t w = bits[i] & (~0ULL << ((pos - base) & 63));
+    while (w == 0 && ++i < WORDS)
+      w = bits[i];
+    if (w != 0) {
+      int p = base + 64*i + __builtin_ctzll(w);
+      return p < len ? p : len;
+    }
+    pos = base + BLOCK;
+  }
+  return len;
+}
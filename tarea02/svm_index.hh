@@ -0,0 +1,41 @@
+#ifndef SVM_INDEX
+#define SVM_INDEX
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+
+// Indice estructural del texto fuente: un bit por byte que no puede ser
+// parte de un identificador o numero, es decir todo lo que no es
+// [A-Za-z0-9_] (espacios, fin de linea, '%', el ':' de los labels y los
+// caracteres invalidos). Con el indice el Scanner salta de un inicio de
+// token al delimitador siguiente sin recorrer el lexema byte a byte.
+//
+// Se arma por bloques de BLOCK bytes a medida que el Scanner avanza, asi que
+// ocupa lo mismo para cualquier tamano de programa. La clasificacion usa
+// AVX2 (32 bytes por paso), SSE4.2 (16 bytes con pcmpestrm) o una version
+// escalar, segun lo que soporte la CPU al ejecutar.
+class StructuralIndex {
+public:
+  static const int BLOCK = 4096;
+  StructuralIndex(const char* text, int len);
+  // Posicion del primer delimitador en [pos, len); len si no hay
+  int next(int pos);
+  // Nucleo en uso ("avx2", "sse4.2" o "scalar")
+  static const char* kernel();
+  // Fuerza un nucleo (para comparar en svm_bench); false si la CPU no lo
+  // soporta o no existe
+  static bool select(const string& name);
+private:
+  static const int WORDS = BLOCK / 64;
+  const char* text;
+  int len;
+  int base; // primer byte del bloque indexado, -1: ninguno
+  uint64_t bits[WORDS];
+  void build(int base);
+};
+
+
+#endif
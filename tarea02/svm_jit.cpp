@@ -0,0 +1,167 @@
+#include <iostream>
+#include <cstring>
+
+#include "svm.hh"
+
+/* ******** JIT x86-64 *********** */
+
+// Como el programa esta verificado, la altura de la pila en cada
+// instruccion es conocida: cada slot se direcciona con un desplazamiento
+// fijo desde la base de opstack (rbx) y los registros del SVM desde rbp.
+// El codigo generado tiene la forma
+//   int f(int* stack, int* registers, ExecutionContext* vm)
+// y print vuelve al runtime a traves de ExecutionContext::jit_print. Una
+// excepcion no puede cruzar el codigo generado, asi que una division
+// invalida sale por el epilogo devolviendo 1 y el error se lanza despues de
+// liberar el codigo.
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+enum { EAX=0, ECX=1, EDX=2, EBX=3, EBP=5 };
+
+class X64Emitter {
+public:
+  vector<unsigned char> buf;
+  void byte(int b) { buf.push_back(b); }
+  void imm32(int v) {
+    for (int k=0; k < 4; k++) byte((v >> (8*k)) & 0xff);
+  }
+  void imm64(uint64_t v) {
+    for (int k=0; k < 8; k++) byte((v >> (8*k)) & 0xff);
+  }
+  // opcode con operando de memoria [base+disp32]
+  void mem(int opcode, int reg, int base, int disp) {
+    byte(opcode);
+    byte(0x80 | (reg << 3) | base);
+    imm32(disp);
+  }
+  void load(int reg, int base, int disp) { mem(0x8B, reg, base, disp); }
+  void store(int base, int disp, int reg) { mem(0x89, reg, base, disp); }
+  void storeImm(int base, int disp, int v) { mem(0xC7, 0, base, disp); imm32(v); }
+  // devuelve la posicion del rel32 para corregirla despues
+  int jmp() { byte(0xE9); imm32(0); return buf.size()-4; }
+  int jcc(int cc) { byte(0x0F); byte(cc); imm32(0); return buf.size()-4; }
+  void patch(int at, int dest) {
+    int rel = dest - (at+4);
+    memcpy(&buf[at], &rel, 4);
+  }
+};
+
+void ExecutionContext::jit_print(ExecutionContext* vm, int h) {
+  vm->opstack.resize(h);
+  vm->print_stack();
+}
+
+typedef int (*JitFn)(int*, int*, ExecutionContext*);
+
+bool ExecutionContext::run_jit() {
+  int n = prog.code.size();
+  if (pc != 0) return false;
+  X64Emitter e;
+  // prologo: guardar rbx, rbp, r14 (deja rsp alineado a 16)
+  e.byte(0x53); e.byte(0x55); e.byte(0x41); e.byte(0x56);
+  e.byte(0x48); e.byte(0x89); e.byte(0xFB);  // mov rbx, rdi
+  e.byte(0x48); e.byte(0x89); e.byte(0xF5);  // mov rbp, rsi
+  e.byte(0x49); e.byte(0x89); e.byte(0xD6);  // mov r14, rdx
+  vector<int> native(n+2, 0); // native[n]: fin, native[n+1]: error de division
+  vector<pair<int,int> > fixups; // (posicion rel32, destino)
+  for (int i=0; i < n; i++) {
+    native[i] = e.buf.size();
+    int h = prog.height[i];
+    if (h == -1) continue; // inalcanzable
+    int top = 4*(h-1), next = 4*(h-2), free = 4*h;
+    const Code& c = prog.code[i];
+    switch (c.op) {
+    case Instruction::IPUSH: e.storeImm(EBX, free, c.arg); break;
+    case Instruction::IPOP: break;
+    case Instruction::IDUP:
+      e.load(EAX, EBX, top); e.store(EBX, free, EAX); break;
+    case Instruction::ISWAP:
+      e.load(EAX, EBX, top); e.load(ECX, EBX, next);
+      e.store(EBX, next, EAX); e.store(EBX, top, ECX); break;
+    case Instruction::IADD:
+      e.load(EAX, EBX, top); e.mem(0x01, EAX, EBX, next); break;
+    case Instruction::ISUB:
+      e.load(EAX, EBX, top); e.mem(0x29, EAX, EBX, next); break;
+    case Instruction::IMUL:
+      e.load(EAX, EBX, next);
+      e.byte(0x0F); e.mem(0xAF, EAX, EBX, top);  // imul eax, [top]
+      e.store(EBX, next, EAX); break;
+    case Instruction::IDIV:
+      e.load(ECX, EBX, top);
+      e.byte(0x85); e.byte(0xC9);                 // test ecx, ecx
+      fixups.push_back(make_pair(e.jcc(0x84), n+1));
+      e.load(EAX, EBX, next);
+      e.byte(0x83); e.byte(0xF9); e.byte(0xFF);   // cmp ecx, -1
+      e.byte(0x75); e.byte(11);                   // jne (sobre cmp y je)
+      e.byte(0x3D); e.imm32(INT_MIN);             // cmp eax, INT_MIN
+      fixups.push_back(make_pair(e.jcc(0x84), n+1));
+      e.byte(0x99);                               // cdq
+      e.byte(0xF7); e.byte(0xF9);                 // idiv ecx
+      e.store(EBX, next, EAX); break;
+    case Instruction::IGOTO:
+      fixups.push_back(make_pair(e.jmp(), c.arg)); break;
+    case Instruction::IJMPEQ: case Instruction::IJMPGT: case Instruction::IJMPGE:
+    case Instruction::IJMPLT: case Instruction::IJMPLE: {
+      static const int cc[5] = { 0x84, 0x8F, 0x8D, 0x8C, 0x8E }; // je jg jge jl jle
+      e.load(EAX, EBX, next);
+      e.mem(0x3B, EAX, EBX, top);                 // cmp eax, [top]
+      fixups.push_back(make_pair(e.jcc(cc[c.op - Instruction::IJMPEQ]), c.arg));
+      break;
+    }
+    case Instruction::ISKIP: break;
+    case Instruction::ISTORE:
+      e.load(EAX, EBX, top); e.store(EBP, 4*c.arg, EAX); break;
+    case Instruction::ILOAD:
+      e.load(EAX, EBP, 4*c.arg); e.store(EBX, free, EAX); break;
+    case Instruction::IPRINT:
+      e.byte(0x4C); e.byte(0x89); e.byte(0xF7);   // mov rdi, r14
+      e.byte(0xBE); e.imm32(h);                   // mov esi, h
+      e.byte(0x48); e.byte(0xB8); e.imm64((uint64_t) &ExecutionContext::jit_print); // mov rax, jit_print
+      e.byte(0xFF); e.byte(0xD0);                 // call rax
+      break;
+    default:
+      return false;
+    }
+  }
+  native[n] = e.buf.size();
+  e.byte(0x31); e.byte(0xC0);                     // xor eax, eax
+  int epilogue = e.buf.size();
+  e.byte(0x41); e.byte(0x5E); e.byte(0x5D); e.byte(0x5B); e.byte(0xC3);
+  native[n+1] = e.buf.size();
+  e.byte(0xB8); e.imm32(1);                       // mov eax, 1
+  e.patch(e.jmp(), epilogue);
+  for (int k=0; k < fixups.size(); k++)
+    e.patch(fixups[k].first, native[fixups[k].second]);
+
+  size_t size = e.buf.size();
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return false;
+  memcpy(mem, e.buf.data(), size);
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return false;
+  }
+  JitFn f = (JitFn) mem;
+  int failed = f(opstack.base(), registers, this);
+  munmap(mem, size);
+  if (failed) divisionError();
+  opstack.resize(prog.exitheight);
+  pc = n;
+  return true;
+}
+
+#else
+
+void ExecutionContext::jit_print(ExecutionContext* vm, int h) {
+  vm->opstack.resize(h);
+  vm->print_stack();
+}
+
+bool ExecutionContext::run_jit() {
+  return false;
+}
+
+#endif
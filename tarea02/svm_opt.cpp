@@ -0,0 +1,461 @@
+#include <iostream>
+#include <unordered_set>
+#include <climits>
+
+#include "svm_opt.hh"
+#include "svm_cfg.hh"
+
+Optimizer::Optimizer(bool openRegisters):openRegisters(openRegisters),removed(0),unreachable(0),folded(0) {
+}
+
+void Optimizer::kill(int i) {
+  dead[i] = true;
+}
+
+unordered_map<string,int> Optimizer::labelIndex() {
+  unordered_map<string,int> at;
+  for (int i=0; i < prog.size(); i++)
+    if (!dead[i] && prog[i]->label != "")
+      at[prog[i]->label] = i;
+  return at;
+}
+
+// Elimina las instrucciones marcadas. Los labels eliminados pasan a la
+// siguiente instruccion viva; si ya tiene label, los saltos se renombran.
+void Optimizer::compact() {
+  vector<Instruction*> out;
+  vector<string> pending;
+  unordered_map<string,string> alias;
+  out.reserve(prog.size());
+  for (int i=0; i < prog.size(); i++) {
+    Instruction* s = prog[i];
+    if (dead[i]) {
+      if (s->label != "") pending.push_back(s->label);
+      delete s;
+      continue;
+    }
+    if (!pending.empty()) {
+      if (s->label == "") {
+	s->label = pending.back();
+	pending.pop_back();
+      }
+      for (int k=0; k < pending.size(); k++)
+	alias[pending[k]] = s->label;
+      pending.clear();
+    }
+    out.push_back(s);
+    out.insert(out.end(), extra[i].begin(), extra[i].end());
+  }
+  if (!pending.empty()) {
+    // labels al final del programa: solo se conservan si alguien salta ahi
+    unordered_set<string> used;
+    for (int i=0; i < out.size(); i++)
+      if (out[i]->jmplabel != "") used.insert(out[i]->jmplabel);
+    Instruction* end = NULL;
+    for (int k=0; k < pending.size(); k++) {
+      if (!used.count(pending[k])) continue;
+      if (end == NULL) {
+	end = new Instruction(pending[k], Instruction::ISKIP);
+	out.push_back(end);
+      } else
+	alias[pending[k]] = end->label;
+    }
+  }
+  if (!alias.empty())
+    for (int i=0; i < out.size(); i++) {
+      unordered_map<string,string>::const_iterator it = alias.find(out[i]->jmplabel);
+      if (it != alias.end()) out[i]->jmplabel = it->second;
+    }
+  prog.swap(out);
+  dead.assign(prog.size(), false);
+  extra.assign(prog.size(), vector<Instruction*>());
+}
+
+// Un salto a un label cuya instruccion es goto M pasa a saltar a M
+bool Optimizer::threadJumps() {
+  unordered_map<string,int> at = labelIndex();
+  bool changed = false;
+  for (int i=0; i < prog.size(); i++) {
+    Instruction* s = prog[i];
+    if (dead[i] || !isJump(s->type)) continue;
+    string cur = s->jmplabel;
+    unordered_set<int> visited;
+    while (true) {
+      unordered_map<string,int>::const_iterator it = at.find(cur);
+      if (it == at.end()) break;
+      int t = it->second;
+      if (prog[t]->type != Instruction::IGOTO || visited.count(t)) break;
+      visited.insert(t);
+      cur = prog[t]->jmplabel;
+    }
+    if (cur != s->jmplabel) {
+      s->jmplabel = cur;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+static bool isReg(Instruction* s) {
+  return s->argint >= 0 && s->argint <= 7;
+}
+
+bool Optimizer::peepholeSweep() {
+  int n = prog.size();
+  bool changed = false;
+  int loads[8] = { 0 };
+  for (int i=0; i < n; i++)
+    if (prog[i]->type == Instruction::ILOAD && isReg(prog[i])) loads[prog[i]->argint]++;
+  unordered_map<string,int> at = labelIndex();
+  for (int i=0; i < n; i++) {
+    Instruction* a = prog[i];
+    Instruction* b = (i+1 < n) ? prog[i+1] : NULL;
+    bool pair = (b != NULL && b->label == ""); // b no es destino de salto
+    Instruction::IType ta = a->type;
+    if (ta == Instruction::ISKIP) {
+      if (a->label == "" || i+1 < n) { // un label al final necesita su skip
+	kill(i);
+	changed = true;
+      }
+      continue;
+    }
+    if (pair) {
+      Instruction::IType tb = b->type;
+      if ((ta == Instruction::IPUSH && tb == Instruction::IPOP) ||
+	  (ta == Instruction::IDUP && tb == Instruction::IPOP) ||
+	  (ta == Instruction::ISWAP && tb == Instruction::ISWAP) ||
+	  (ta == Instruction::ILOAD && tb == Instruction::ISTORE && a->argint == b->argint)) {
+	if (ta == Instruction::ILOAD && isReg(a)) loads[a->argint]--;
+	kill(i); kill(i+1);
+	i++;
+	changed = true;
+	continue;
+      }
+      if (ta == Instruction::ISTORE && tb == Instruction::ILOAD && a->argint == b->argint && isReg(a)) {
+	if (loads[a->argint] == 1 && !openRegisters) {
+	  // el registro no se vuelve a leer: el par no hace nada
+	  kill(i); kill(i+1);
+	  loads[a->argint]--;
+	} else {
+	  a->type = Instruction::IDUP; a->hasarg = false;
+	  b->type = Instruction::ISTORE;
+	}
+	i++;
+	changed = true;
+	continue;
+      }
+    }
+    if (ta == Instruction::ISTORE && isReg(a) && loads[a->argint] == 0 && !openRegisters) {
+      a->type = Instruction::IPOP; a->hasarg = false; // store muerto
+      changed = true;
+      continue;
+    }
+    if (isJump(ta) && b != NULL) {
+      unordered_map<string,int>::const_iterator it = at.find(a->jmplabel);
+      if (it != at.end() && it->second == i+1) {
+	// salto a la siguiente instruccion
+	if (ta == Instruction::IGOTO)
+	  kill(i);
+	else {
+	  a->type = Instruction::IPOP; a->hasarg = false; a->jmplabel = "";
+	  extra[i].push_back(new Instruction("", Instruction::IPOP));
+	}
+	changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+// Aplica las reglas de mirilla hasta que ninguna cambie el programa y
+// devuelve cuantas instrucciones se eliminaron.
+int Optimizer::peephole(list<Instruction*>& sl) {
+  prog.assign(sl.begin(), sl.end());
+  dead.assign(prog.size(), false);
+  extra.assign(prog.size(), vector<Instruction*>());
+  int before = prog.size();
+  bool changed = true;
+  while (changed) {
+    changed = threadJumps();
+    if (peepholeSweep()) changed = true;
+    compact();
+  }
+  sl.assign(prog.begin(), prog.end());
+  removed = before - prog.size();
+  return removed;
+}
+
+/* ******** Propagacion de constantes *********** */
+
+// Valor abstracto de un slot de la pila o de un registro
+struct CVal {
+  enum Kind { UNDEF, CONST, NAC } kind;
+  int v;
+  CVal():kind(UNDEF),v(0) { }
+  CVal(int c):kind(CONST),v(c) { }
+  static CVal nac() { CVal x; x.kind = NAC; return x; }
+  bool isConst() const { return kind == CONST; }
+  bool operator!=(const CVal& o) const { return kind != o.kind || (kind == CONST && v != o.v); }
+};
+
+static CVal meet(const CVal& a, const CVal& b) {
+  if (a.kind == CVal::UNDEF) return b;
+  if (b.kind == CVal::UNDEF) return a;
+  if (a.isConst() && b.isConst() && a.v == b.v) return a;
+  return CVal::nac();
+}
+
+// Estado a la entrada de un bloque: pila abstracta (la altura es fija) y
+// registros, que el SVM inicializa en 0 (desconocidos con openRegisters)
+struct CState {
+  bool seen;
+  vector<CVal> stack;
+  CVal regs[8];
+  CState():seen(false) { }
+};
+
+// Aritmetica como en el SVM (con desborde modulo 2^32). La division entre
+// 0 y INT_MIN / -1 no se evaluan: el error queda para la ejecucion.
+static bool evalBinop(Instruction::IType op, int a, int b, int& r) {
+  switch (op) {
+  case Instruction::IADD: r = (int) ((unsigned) a + (unsigned) b); return true;
+  case Instruction::ISUB: r = (int) ((unsigned) a - (unsigned) b); return true;
+  case Instruction::IMUL: r = (int) ((unsigned) a * (unsigned) b); return true;
+  case Instruction::IDIV:
+    if (b == 0 || (a == INT_MIN && b == -1)) return false;
+    r = a / b; return true;
+  default: return false;
+  }
+}
+
+static bool evalCond(Instruction::IType op, int a, int b) {
+  switch (op) {
+  case Instruction::IJMPEQ: return a == b;
+  case Instruction::IJMPGT: return a > b;
+  case Instruction::IJMPGE: return a >= b;
+  case Instruction::IJMPLT: return a < b;
+  default: return a <= b;
+  }
+}
+
+static bool isBinop(Instruction::IType op) {
+  return op >= Instruction::IADD && op <= Instruction::IDIV;
+}
+
+// Efecto de una instruccion sobre el estado abstracto. Devuelve false si la
+// instruccion fallaria al cargar (pila vacia, registro invalido): en ese caso
+// no se optimiza y el verificador del SVM reporta el error.
+static bool transfer(Instruction* s, CState& st) {
+  vector<CVal>& sk = st.stack;
+  int h = sk.size();
+  switch (s->type) {
+  case Instruction::IPUSH: sk.push_back(CVal(s->argint)); break;
+  case Instruction::IPOP:
+    if (h < 1) return false;
+    sk.pop_back(); break;
+  case Instruction::IDUP:
+    if (h < 1) return false;
+    sk.push_back(sk.back()); break;
+  case Instruction::ISWAP:
+    if (h < 2) return false;
+    swap(sk[h-1], sk[h-2]); break;
+  case Instruction::IADD: case Instruction::ISUB:
+  case Instruction::IMUL: case Instruction::IDIV: {
+    if (h < 2) return false;
+    CVal a = sk[h-2], b = sk[h-1];
+    int r;
+    sk.pop_back();
+    if (a.isConst() && b.isConst() && evalBinop(s->type, a.v, b.v, r))
+      sk.back() = CVal(r);
+    else
+      sk.back() = CVal::nac();
+    break;
+  }
+  case Instruction::IJMPEQ: case Instruction::IJMPGT: case Instruction::IJMPGE:
+  case Instruction::IJMPLT: case Instruction::IJMPLE:
+    if (h < 2) return false;
+    sk.pop_back(); sk.pop_back(); break;
+  case Instruction::ISTORE:
+    if (h < 1 || !isReg(s)) return false;
+    st.regs[s->argint] = sk.back();
+    sk.pop_back(); break;
+  case Instruction::ILOAD:
+    if (!isReg(s)) return false;
+    sk.push_back(st.regs[s->argint]); break;
+  default: // goto, skip, print
+    break;
+  }
+  return true;
+}
+
+static bool propagate(CState& to, const CState& from, bool& changed) {
+  changed = false;
+  if (!to.seen) {
+    to = from;
+    changed = true;
+    return true;
+  }
+  if (to.stack.size() != from.stack.size()) return false; // alturas distintas
+  for (int k=0; k < to.stack.size(); k++) {
+    CVal m = meet(to.stack[k], from.stack[k]);
+    if (m != to.stack[k]) { to.stack[k] = m; changed = true; }
+  }
+  for (int r=0; r < 8; r++) {
+    CVal m = meet(to.regs[r], from.regs[r]);
+    if (m != to.regs[r]) { to.regs[r] = m; changed = true; }
+  }
+  return true;
+}
+
+// Propagacion de constantes sobre el CFG (slots de la pila y registros) y
+// plegado dentro de cada bloque:
+//  - load r / dup con valor conocido pasan a ser push k;
+//  - una operacion con ambos operandos conocidos, producidos por push
+//    (o load, dup) del mismo bloque, se reemplaza por push del resultado;
+//  - un salto condicional con resultado conocido pasa a goto o desaparece;
+//  - un pop elimina al push que produjo su valor y un swap de dos push
+//    intercambia sus constantes.
+// Un print lee toda la pila, asi que los valores anteriores se conservan.
+// Los bloques a los que ya no se llega los elimina despues el CFG.
+int Optimizer::fold(list<Instruction*>& sl) {
+  folded = 0;
+  CFG cfg(sl);
+  int nb = cfg.blocks.size();
+  if (nb == 0) return 0;
+  vector<CState> in(nb);
+  in[0].seen = true;
+  for (int r=0; r < 8; r++) in[0].regs[r] = openRegisters ? CVal::nac() : CVal(0);
+  vector<int> work(1, 0);
+  vector<bool> queued(nb, false);
+  queued[0] = true;
+  while (!work.empty()) {
+    int k = work.back(); work.pop_back();
+    queued[k] = false;
+    const BasicBlock& b = cfg.blocks[k];
+    CState st = in[k];
+    int outcome = -1; // -1 desconocido, 0 no salta, 1 salta
+    for (int i=b.first; i <= b.last; i++) {
+      Instruction* s = cfg.instruction(i);
+      int h = st.stack.size();
+      if (isCondJump(s->type) && h >= 2 && st.stack[h-2].isConst() && st.stack[h-1].isConst())
+	outcome = evalCond(s->type, st.stack[h-2].v, st.stack[h-1].v);
+      if (!transfer(s, st)) return 0;
+    }
+    if (isJump(cfg.instruction(b.last)->type) && b.target < 0) return 0; // label desconocido
+    int next[2] = { outcome != 0 ? b.target : -1, outcome != 1 ? b.fallthrough : -1 };
+    for (int j=0; j < 2; j++) {
+      int t = next[j];
+      if (t < 0) continue;
+      bool changed;
+      if (!propagate(in[t], st, changed)) return 0;
+      if (changed && !queued[t]) {
+	queued[t] = true;
+	work.push_back(t);
+      }
+    }
+  }
+
+  prog.assign(sl.begin(), sl.end());
+  dead.assign(prog.size(), false);
+  extra.assign(prog.size(), vector<Instruction*>());
+  for (int k=0; k < nb; k++) {
+    if (!in[k].seen) continue;
+    const BasicBlock& b = cfg.blocks[k];
+    CState st = in[k];
+    vector<int> prod(st.stack.size(), -1); // instruccion que puso el valor, si se puede quitar
+    for (int i=b.first; i <= b.last; i++) {
+      Instruction* s = prog[i];
+      Instruction::IType t = s->type;
+      int h = st.stack.size();
+      CVal top = h > 0 ? st.stack[h-1] : CVal(), next = h > 1 ? st.stack[h-2] : CVal();
+      CVal reg = (t == Instruction::ILOAD) ? st.regs[s->argint] : CVal();
+      transfer(s, st);
+      if (t == Instruction::IPUSH) {
+	prod.push_back(i);
+      } else if (t == Instruction::ILOAD || t == Instruction::IDUP) {
+	CVal v = (t == Instruction::ILOAD) ? reg : top;
+	if (v.isConst()) {
+	  s->type = Instruction::IPUSH; s->hasarg = true; s->argint = v.v;
+	  folded++;
+	} else if (t == Instruction::IDUP)
+	  prod[h-1] = -1; // el valor copiado se lee
+	prod.push_back(i);
+      } else if (t == Instruction::IPOP) {
+	if (prod[h-1] >= 0) {
+	  kill(prod[h-1]); kill(i);
+	  folded++;
+	}
+	prod.pop_back();
+      } else if (t == Instruction::ISWAP) {
+	int pa = prod[h-2], pb = prod[h-1];
+	if (pa >= 0 && pb >= 0 && prog[pa]->type == Instruction::IPUSH && prog[pb]->type == Instruction::IPUSH) {
+	  swap(prog[pa]->argint, prog[pb]->argint); // los push ya dejan el orden final
+	  kill(i);
+	  folded++;
+	} else
+	  prod[h-1] = prod[h-2] = -1;
+      } else if (isBinop(t)) {
+	int r;
+	bool known = next.isConst() && top.isConst() && evalBinop(t, next.v, top.v, r);
+	if (known && prod[h-2] >= 0 && prod[h-1] >= 0) {
+	  kill(prod[h-2]); kill(prod[h-1]);
+	  s->type = Instruction::IPUSH; s->hasarg = true; s->argint = r;
+	  folded++;
+	  prod.pop_back();
+	  prod.back() = i;
+	} else {
+	  prod.pop_back();
+	  prod.back() = -1;
+	}
+      } else if (isCondJump(t)) {
+	if (next.isConst() && top.isConst()) {
+	  bool taken = evalCond(t, next.v, top.v);
+	  if (prod[h-2] >= 0 && prod[h-1] >= 0) {
+	    kill(prod[h-2]); kill(prod[h-1]);
+	    if (taken) s->type = Instruction::IGOTO;
+	    else kill(i);
+	  } else {
+	    string target = s->jmplabel;
+	    s->type = Instruction::IPOP; s->hasarg = false; s->jmplabel = "";
+	    extra[i].push_back(new Instruction("", Instruction::IPOP));
+	    if (taken) extra[i].push_back(new Instruction("", Instruction::IGOTO, target));
+	  }
+	  folded++;
+	}
+	prod.pop_back(); prod.pop_back();
+      } else if (t == Instruction::ISTORE) {
+	prod.pop_back();
+      } else if (t == Instruction::IPRINT) {
+	prod.assign(prod.size(), -1);
+      }
+    }
+  }
+  compact();
+  sl.assign(prog.begin(), prog.end());
+  return folded;
+}
+
+// Pipeline completo (-O): mirilla y propagacion de constantes hasta que no
+// haya cambios, eliminacion de bloques inalcanzables y reordenamiento de
+// bloques, y otra vez mirilla para limpiar los goto y skip que deja el
+// reordenamiento. Devuelve el total de instrucciones eliminadas.
+int Optimizer::optimize(list<Instruction*>& sl) {
+  // Las pasadas pueden quitar justo lo que el verificador rechaza (un
+  // underflow en un par dup/pop, un label inexistente en codigo muerto), asi
+  // que el programa se verifica antes: -O no cambia que programas se aceptan
+  Program check(sl);
+  int before = sl.size();
+  int rewrites = 0;
+  do {
+    peephole(sl);
+    rewrites += fold(sl);
+  } while (folded > 0);
+  folded = rewrites;
+  CFG cfg(sl);
+  unreachable = cfg.removeUnreachable();
+  cfg.reorder();
+  cfg.toList(sl);
+  peephole(sl);
+  removed = before - unreachable - sl.size();
+  return before - sl.size();
+}
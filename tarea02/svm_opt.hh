@@ -0,0 +1,43 @@
+#ifndef SVM_OPT
+#define SVM_OPT
+
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+#include "svm.hh"
+
+using namespace std;
+
+
+// Pasadas de optimizacion sobre el programa reconocido por el Parser, antes
+// de construir el SVM. Trabajan con labels (no con indices) y mantienen su
+// semantica: el label de una instruccion eliminada pasa a la siguiente.
+//
+// Por omision los registros empiezan en 0 y nadie los mira al terminar. Con
+// openRegisters (lo usa --sweep, que los carga del CSV e imprime su valor
+// final) su valor inicial es desconocido y todos estan vivos a la salida.
+class Optimizer {
+private:
+  bool openRegisters;
+  vector<Instruction*> prog;
+  vector<bool> dead;
+  vector<vector<Instruction*> > extra; // instrucciones que se insertan despues
+  void kill(int i);
+  void compact();
+  unordered_map<string,int> labelIndex();
+  bool threadJumps();
+  bool peepholeSweep();
+public:
+  int removed;     // instrucciones eliminadas por la ultima pasada de mirilla
+  int unreachable; // instrucciones en bloques inalcanzables
+  int folded;      // reescrituras de la propagacion de constantes
+  Optimizer(bool openRegisters = false);
+  int peephole(list<Instruction*>& sl);
+  int fold(list<Instruction*>& sl);
+  int optimize(list<Instruction*>& sl);
+};
+
+
+#endif
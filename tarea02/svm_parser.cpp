@@ -2,21 +2,19 @@
 #include <iostream>
 #include <stdlib.h>
 #include <cstring>
+#include <climits>
 
 #include <fstream>
+#include <cerrno>
+#include <unistd.h>
+#include <thread>
+#include <exception>
 
 #include "svm_parser.hh"
+#include "../svm_mnemonics.hh"
 
 const char* Token::token_names[24] = { "ID", "LABEL", "NUM", "EOL", "ERR", "END", "PUSH", "JMEPEQ", "JMPGT", "JMPGE", "JMPLT", "JMPLE", "GOTO", "SKIP", "POP", "DUP", "SWAP", "ADD", "SUB", "MUL", "DIV", "STORE", "LOAD", "PRINT" };
 
-Token::Token(Type type):type(type) { lexema = ""; }
-
-Token::Token(Type type, char c):type(type) { lexema = c; }
-
-Token::Token(Type type, const string source):type(type) {
-  lexema = source;
-}
-
 std::ostream& operator << ( std::ostream& outs, const Token & tok )
 {
   if (tok.lexema.empty())
@@ -25,64 +23,68 @@ std::ostream& operator << ( std::ostream& outs, const Token & tok )
     return outs << Token::token_names[tok.type] << "(" << tok.lexema << ")";
 }
 
-std::ostream& operator << ( std::ostream& outs, const Token* tok ) {
-  return outs << *tok;
-}
+// Palabras reservadas (hash perfecto armado al compilar, ver svm_mnemonics.hh)
+static constexpr Mnemonic<Token::Type> mnemonics[] = {
+  {"push", Token::PUSH}, {"jmpeq", Token::JMPEQ}, {"jmpgt", Token::JMPGT},
+  {"jmpge", Token::JMPGE}, {"jmplt", Token::JMPLT}, {"jmple", Token::JMPLE},
+  {"goto", Token::GOTO}, {"skip", Token::SKIP}, {"pop", Token::POP},
+  {"dup", Token::DUP}, {"swap", Token::SWAP}, {"add", Token::ADD},
+  {"sub", Token::SUB}, {"mul", Token::MUL}, {"div", Token::DIV},
+  {"store", Token::STORE}, {"load", Token::LOAD}, {"print", Token::PRINT}
+};
+static constexpr MnemonicTable reserved(mnemonics, Token::ERR);
 
+Scanner::Scanner(string s):input(s),text(input.data()),len(input.size()),fd(-1),first(0),current(0) {
+  index = new StructuralIndex(text, len);
+}
 
-Scanner::Scanner(string s):input(s),first(0),current(0) {
-  reserved["push"] = Token::PUSH;
-  reserved["jmpeq"] = Token::JMPEQ;
-  reserved["jmpgt"] = Token::JMPGT;
-  reserved["jmpge"] = Token::JMPGE;
-  reserved["jmplt"] = Token::JMPLT;
-  reserved["jmple"] = Token::JMPLE;
-  reserved["goto"] = Token::GOTO;
-  reserved["skip"] = Token::SKIP;
-  reserved["pop"] = Token::POP;
-  reserved["dup"] = Token::DUP;
-  reserved["swap"] = Token::SWAP;
-  reserved["add"] = Token::ADD;   
-  reserved["sub"] = Token::SUB;
-  reserved["mul"] = Token::MUL;
-  reserved["div"] = Token::DIV;
-  reserved["store"] = Token::STORE;
-  reserved["load"] = Token::LOAD;
-  reserved["print"] = Token::PRINT;
+Scanner::Scanner(const char* t, int n):text(t),len(n),fd(-1),first(0),current(0) {
+  index = new StructuralIndex(text, len);
 }
 
-Token* Scanner::nextToken() {
-  Token* token;
+// La ventana de lectura se mueve con cada refill(): sin indice
+Scanner::Scanner(int f):text(NULL),len(0),fd(f),first(0),current(0),index(NULL) { }
+
+Token Scanner::nextToken() {
+  Token token;
   char c;
-  string lex;
   Token::Type ttype;
+  int64_t value = 0; // se acumula mientras se leen los digitos
   c = nextChar();
   if (c == '%'){
-    while (c != '\n')
+    while (c != '\n' && c != '\0')
       c = nextChar();
   }
   while (c == ' ') c = nextChar();
-  if (c == '\0') return new Token(Token::END); 
+  if (c == '\0') return Token(Token::END); 
   startLexema();
   state = 0;
   while (1) {
     switch (state) {
     case 0:
        if (isalpha(c)) { state = 1; }
-      else if (isdigit(c)) { startLexema(); state = 4; }
+      else if (isdigit(c)) { startLexema(); value = c - '0'; state = 4; }
       else if (c == '\n') state = 6;
-      else return new Token(Token::ERR, c);
+      else return Token(Token::ERR, getLexema());
       break;
     case 1:
+      if (index) current = index->next(current); // resto del identificador
       c = nextChar();
        if (isalpha(c) || isdigit(c) || c=='_') state = 1;
       else if (c == ':') state = 3;
       else state = 2;
       break;
     case 4:
+      if (index) {
+	int end = index->next(current);
+	for (; current < end && isdigit(text[current]); current++)
+	  if (value <= INT_MAX) value = value * 10 + (text[current] - '0');
+      }
       c = nextChar();
-      if (isdigit(c)) state = 4;
-      else state = 5;
+      if (isdigit(c)) {
+	if (value <= INT_MAX) value = value * 10 + (c - '0');
+	state = 4;
+      } else state = 5;
       break;
     case 6:
       c = nextChar();
@@ -91,23 +93,24 @@ Token* Scanner::nextToken() {
       break;
     case 2:
       rollBack();
-      lex = getLexema();
-      ttype = checkReserved(lex);
+      ttype = checkReserved(getLexema());
       if (ttype != Token::ERR)
-	return new Token(ttype);
+	return Token(ttype);
       else
-	return new Token(Token::ID, getLexema()); 
+	return Token(Token::ID, getLexema()); 
     case 3:
       rollBack();
-      token = new Token(Token::LABEL,getLexema());
+      token = Token(Token::LABEL,getLexema());
       nextChar();
       return token;
     case 5:
       rollBack();
-      return new Token(Token::NUM,getLexema());
+      if (value > INT_MAX)
+	throw SVMError("Number out of range " + string(getLexema()));
+      return Token(Token::NUM, getLexema(), value);
     case 7:
       rollBack();
-      return new Token(Token::EOL);
+      return Token(Token::EOL);
     default:
       cout << "Programming Error ... quitting" << endl;
       exit(0);
@@ -116,12 +119,38 @@ Token* Scanner::nextToken() {
 
 }
 
-Scanner::~Scanner() { }
+Scanner::~Scanner() { delete index; }
+
+// Lectura por bloques: se descarta lo anterior al lexema actual (y al
+// caracter previo, que rollBack() puede volver a leer) y se agrega el
+// siguiente bloque. Devuelve false al terminar fd.
+bool Scanner::refill() {
+  int keep = min(first, current-1);
+  if (keep > 0) {
+    input.erase(0, keep);
+    first -= keep;
+    current -= keep;
+  }
+  int old = input.size();
+  input.resize(old + CHUNK);
+  ssize_t r;
+  do
+    r = read(fd, &input[old], CHUNK);
+  while (r < 0 && errno == EINTR);
+  input.resize(old + (r > 0 ? r : 0));
+  text = input.data();
+  len = input.size();
+  if (r <= 0) fd = -1;
+  return r > 0;
+}
 
+// Fuera del texto devuelve '\0'
 char Scanner::nextChar() {
-  int c = input[current];
-  current++;
-  return c;
+  if (current >= len && (fd < 0 || !refill())) {
+    current++;
+    return '\0';
+  }
+  return text[current++];
 }
 
 void Scanner::rollBack() { // retract
@@ -138,16 +167,12 @@ void Scanner::incrStartLexema() {
 }
 
 
-string Scanner::getLexema() {
-  return input.substr(first,current-first);
+string_view Scanner::getLexema() {
+  return string_view(text+first, current-first);
 }
 
-Token::Type Scanner::checkReserved(string lexema) {
-  std::unordered_map<std::string,Token::Type>::const_iterator it = reserved.find (lexema);
-  if (it == reserved.end())
-    return Token::ERR;
- else
-   return it->second;
+Token::Type Scanner::checkReserved(string_view lexema) {
+  return reserved.find(lexema);
 }
 
 Instruction::IType Token::tokenToIType(Token::Type tt) {
@@ -190,19 +215,18 @@ bool Parser::match(Token::Type ttype) {
 
 bool Parser::check(Token::Type ttype) {
   if (isAtEnd()) return false;
-  return current->type == ttype;
+  return current.type == ttype;
 }
 
 
+// El lexema de previous ya no es valido (el Scanner puede haber reusado su
+// texto): lo que se necesita de un token se toma de current antes de avanzar
 bool Parser::advance() {
   if (!isAtEnd()) {
-    Token* temp =current;
-    if (previous) delete previous;
+    previous = current;
     current = scanner->nextToken();
-    previous = temp;
     if (check(Token::ERR)) {
-      cout << "Parse error, unrecognised character: " << current->lexema << endl;
-      exit(0);
+      throw SVMError("Parse error, unrecognised character: " + string(current.lexema));
     }
     return true;
   }
@@ -210,37 +234,95 @@ bool Parser::advance() {
 } 
 
 bool Parser::isAtEnd() {
-  return (current->type == Token::END);
+  return (current.type == Token::END);
 } 
 
 Parser::Parser(Scanner* sc):scanner(sc) {
-  previous = current = NULL;
   return;
 };
 
-SVM* Parser::parse() {
+SVM* Parser::parse(int maxdepth) {
+  list<Instruction*> sl;
+  parse(sl);
+  return new SVM(sl, maxdepth);
+}
+
+// Solo reconoce el programa; permite optimizarlo antes de construir el SVM
+void Parser::parse(list<Instruction*>& sl) {
   current = scanner->nextToken();
   if (check(Token::ERR)) {
-      cout << "Error en scanner - caracter invalido" << endl;
-      exit(0);
+      throw SVMError("Error en scanner - caracter invalido");
   }
   Instruction* instr = NULL;
-  list<Instruction*> sl;
 
-  while (current->type == Token::EOL)
+  while (current.type == Token::EOL)
     current = scanner->nextToken();
 
-  while (current->type != Token::END) {
+  while (current.type != Token::END) {
     instr = parseInstruction();
     sl.push_back(instr);
   }
     
-  if (current->type != Token::END) {
+  if (current.type != Token::END) {
     cout << "Esperaba fin-de-input, se encontro " << current << endl;
   }
-  if (current) delete current;
-  
-  return new SVM(sl);
+}
+
+// Sigue un texto que empieza al inicio de una linea, en el mismo estado en
+// que parse() queda despues de un fin de linea
+void Parser::parseRest(list<Instruction*>& sl) {
+  current = scanner->nextToken();
+  if (check(Token::ERR)) {
+    throw SVMError("Parse error, unrecognised character: " + string(current.lexema));
+  }
+  while (match(Token::EOL))
+    ;
+  while (current.type != Token::END)
+    sl.push_back(parseInstruction());
+}
+
+void Parser::parseParallel(const char* text, int len, list<Instruction*>& sl, int nthreads) {
+  const char* nul = (const char*) memchr(text, 0, len);
+  if (nul != NULL) len = nul - text; // el Scanner termina en el primer '\0'
+  if (nthreads <= 0) nthreads = thread::hardware_concurrency();
+  int t = min(nthreads, len / PARALLEL_CHUNK);
+  if (t <= 1) {
+    Scanner scanner(text, len);
+    Parser parser(&scanner);
+    parser.parse(sl);
+    return;
+  }
+  vector<int> cut(1, 0);
+  for (int k=1; k < t; k++) {
+    int p = max((int) ((int64_t) len * k / t), cut.back());
+    const char* nl = (const char*) memchr(text + p, '\n', len - p);
+    if (nl == NULL) break;
+    if (nl - text + 1 < len) cut.push_back(nl - text + 1);
+  }
+  cut.push_back(len);
+  int n = cut.size() - 1;
+  vector<list<Instruction*> > parts(n);
+  vector<exception_ptr> errors(n);
+  parallelFor(n, [&](int k) {
+    try {
+      Scanner scanner(text + cut[k], cut[k+1] - cut[k]);
+      Parser parser(&scanner);
+      if (k == 0) parser.parse(parts[k]);
+      else parser.parseRest(parts[k]);
+    } catch (...) {
+      errors[k] = current_exception();
+    }
+  });
+  // como parse(sl): queda lo anterior al primer error y lo demas se libera
+  for (int k=0; k < n; k++) {
+    sl.splice(sl.end(), parts[k]);
+    if (errors[k]) {
+      for (int j=k+1; j < n; j++)
+	for (list<Instruction*>::iterator it = parts[j].begin(); it != parts[j].end(); ++it)
+	  delete *it;
+      rethrow_exception(errors[k]);
+    }
+  }
 }
 
 Instruction* Parser::parseInstruction() {
@@ -251,58 +333,59 @@ Instruction* Parser::parseInstruction() {
   Token::Type ttype;
   int tipo = 0;
   
-  if (match(Token::LABEL)){
-    label = previous->lexema;
+  if (check(Token::LABEL)){
+    label = current.lexema;
+    advance();
   }
 
   if (match(Token::SKIP) || match(Token::POP) || match(Token::DUP) || match(Token::SWAP) || match(Token::ADD) || match(Token::SUB) || match(Token::MUL) || match(Token::DIV) || match(Token::PRINT))
   {
     tipo = 0;
-    ttype = previous->type;
+    ttype = previous.type;
   }
 
   else if (match(Token::PUSH) || match(Token::STORE) || match(Token::LOAD))
   {
     tipo = 1;
-    ttype = previous->type;
+    ttype = previous.type;
 
-    if (!match(Token::NUM)){
-      cout << "Expecting number" << endl;
-      exit(0);
+    if (!check(Token::NUM)){
+      throw SVMError("Expecting number");
     }
 
-    argint = stoi(previous->lexema);
+    argint = current.value;
+    advance();
 
   }
 
   else if (match(Token::JMPEQ) || match(Token::JMPGT) || match(Token::JMPGE) || match(Token::JMPLT) || match(Token::JMPLE) || match(Token::GOTO))
   { 
     tipo = 2;
-    ttype = previous->type;
+    ttype = previous.type;
 
-    if (!match(Token::ID)){
-      cout << "Expecting jump label" << endl;
-      exit(0);
+    if (!check(Token::ID)){
+      throw SVMError("Expecting jump label");
     }
 
-    jmplabel = previous->lexema;
+    jmplabel = current.lexema;
+    advance();
   }
   else
   {
-    cout << "Error: no pudo encontrar match para " << current << endl;  
-    exit(0);
+    std::ostringstream msg;
+    msg << "Error: no pudo encontrar match para " << current;
+    throw SVMError(msg.str());
   }
   if (!match(Token::EOL)) {
 
-    if (current->type != 5){
-      cout << "Esperaba fin de linea" << endl;
-      exit(0);
+    if (current.type != Token::END){
+      throw SVMError("Esperaba fin de linea");
     }
   }
   else{
-    while (match(Token::EOL)){
-      current = scanner->nextToken();
-    }
+    // una linea con solo espacios da un EOL aparte
+    while (match(Token::EOL))
+      ;
   }
 
   if (tipo == 0) {
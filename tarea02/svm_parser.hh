@@ -2,57 +2,84 @@
 #define SVM_PARSER
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
 #include "svm.hh"
+#include "svm_index.hh"
 
 using namespace std;
 
+// Token por valor: el lexema apunta al texto del Scanner y vale hasta la
+// siguiente llamada a nextToken(), asi que reconocer un token no reserva
+// memoria.
 class Token {
 public:
   enum Type { ID=0, LABEL, NUM, EOL, ERR, END, PUSH, JMPEQ, JMPGT, JMPGE, JMPLT, JMPLE, GOTO, SKIP, POP, DUP, SWAP, ADD, SUB, MUL, DIV, STORE, LOAD, PRINT };
   static const char* token_names[24]; 
   Type type;
-  string lexema;
-  Token(Type);
-  Token(Type, char c);
-  Token(Type, const string source);
+  string_view lexema;
+  int value; // NUM: el numero ya convertido
+  Token():type(END),value(0) { }
+  Token(Type type):type(type),value(0) { }
+  Token(Type type, string_view lex, int v = 0):type(type),lexema(lex),value(v) { }
   static Instruction::IType tokenToIType(Token::Type tt);
 };
 
-std::ostream& operator << ( std::ostream& outs, const Token* tok );
+std::ostream& operator << ( std::ostream& outs, const Token& tok );
 
+// Recorre el texto a traves de una vista (text, len): puede ser una copia
+// propia, memoria ajena (p.ej. un archivo mapeado) o una ventana que se va
+// llenando por bloques desde un descriptor. Sobre texto completo usa un
+// StructuralIndex para saltar el cuerpo de identificadores y numeros.
 class Scanner {
 public:
+  static const int CHUNK = 64 * 1024;
   Scanner(string in_s);
-  Token* nextToken();
+  Scanner(const char* text, int len); // sin copiar: text debe vivir mas que el Scanner
+  Scanner(int fd); // lee fd por bloques de CHUNK bytes (stdin)
+  Token nextToken();
   ~Scanner();
 private:
-  string input;
+  string input; // copia del texto o ventana de lectura de fd
+  const char* text;
+  int len;
+  int fd; // -1: no queda nada por leer
   int first, current;
   int state;
-  unordered_map<string, Token::Type> reserved;
+  StructuralIndex* index; // NULL al leer de fd
+  Scanner(const Scanner&);
+  Scanner& operator=(const Scanner&);
+  bool refill();
   char nextChar();
   void rollBack();
   void startLexema();
   void incrStartLexema();
-  string getLexema();
-  Token::Type checkReserved(string lexema);
+  string_view getLexema();
+  Token::Type checkReserved(string_view lexema);
 };
 
 
 class Parser {
 private:
   Scanner* scanner;
-  Token *current, *previous;
+  Token current, previous;
   bool match(Token::Type ttype);
   bool check(Token::Type ttype);
   bool advance();
   bool isAtEnd();
   Instruction* parseInstruction();
+  void parseRest(list<Instruction*>& sl);
 public:
+  static const int PARALLEL_CHUNK = 1 << 20; // bytes por hilo como minimo
   Parser(Scanner* scanner);
-  SVM* parse();
+  SVM* parse(int maxdepth = SVM::DEFAULT_STACK);
+  void parse(list<Instruction*>& sl);
+  // Texto completo en paralelo: se corta despues de fines de linea, cada
+  // hilo parsea un pedazo con su propio Scanner y las listas se unen en
+  // orden. Con menos de PARALLEL_CHUNK bytes por hilo parsea en el hilo
+  // actual. Los errores son los de parse(sl): el primero del texto.
+  // nthreads 0: uno por nucleo.
+  static void parseParallel(const char* text, int len, list<Instruction*>& sl, int nthreads = 0);
 };
 
 
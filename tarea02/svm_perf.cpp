@@ -0,0 +1,108 @@
+#include <cstring>
+
+#include "svm_perf.hh"
+
+/* ******** Contadores de hardware *********** */
+
+const char* PerfCounters::names[NUM_COUNTERS] = { "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses" };
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int openCounter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1; // basta con perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+  // cuenta tambien los hilos creados despues (parseParallel, resolveLabels);
+  // su cuenta se suma al terminar, y las fases los esperan antes de stop()
+  attr.inherit = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cacheMiss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+PerfCounters::PerfCounters() {
+  static const uint32_t type[NUM_COUNTERS] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE };
+  static const uint64_t config[NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+    cacheMiss(PERF_COUNT_HW_CACHE_L1D), cacheMiss(PERF_COUNT_HW_CACHE_LL) };
+  for (int k=0; k < NUM_COUNTERS; k++) {
+    values[k] = startv[k] = 0;
+    fd[k] = openCounter(type[k], config[k]);
+    valid[k] = fd[k] >= 0;
+    if (fd[k] < 0 && error == "")
+      error = string("perf_event_open: ") + strerror(errno);
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int k=0; k < NUM_COUNTERS; k++)
+    if (fd[k] >= 0) close(fd[k]);
+}
+
+bool PerfCounters::read(int k, uint64_t& v) {
+  return ::read(fd[k], &v, sizeof(v)) == sizeof(v);
+}
+
+void PerfCounters::start() {
+  for (int k=0; k < NUM_COUNTERS; k++) {
+    if (!valid[k]) continue;
+    if (!read(k, startv[k])) valid[k] = false;
+    ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void PerfCounters::stop() {
+  for (int k=0; k < NUM_COUNTERS; k++) {
+    if (!valid[k]) continue;
+    ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t v;
+    if (read(k, v)) values[k] += v - startv[k];
+    else valid[k] = false;
+  }
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+  for (int k=0; k < NUM_COUNTERS; k++) {
+    values[k] = startv[k] = 0;
+    fd[k] = -1;
+    valid[k] = false;
+  }
+  error = "perf_event_open is only available on Linux";
+}
+
+PerfCounters::~PerfCounters() {
+}
+
+bool PerfCounters::read(int k, uint64_t& v) {
+  return false;
+}
+
+void PerfCounters::start() {
+}
+
+void PerfCounters::stop() {
+}
+
+#endif
+
+bool PerfCounters::available() const {
+  for (int k=0; k < NUM_COUNTERS; k++)
+    if (valid[k]) return true;
+  return false;
+}
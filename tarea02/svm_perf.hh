@@ -0,0 +1,34 @@
+#ifndef SVM_PERF
+#define SVM_PERF
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+
+// Contadores de hardware (perf_event_open) para medir una fase de svm_run.
+// start()/stop() acumulan, asi que una fase puede medirse en varios tramos.
+// Incluyen a los hilos que el proceso crea y espera durante la fase.
+// Si el kernel no permite abrir un contador, ese valor queda invalido y el
+// resto se sigue midiendo.
+class PerfCounters {
+public:
+  enum Counter { CYCLES=0, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, NUM_COUNTERS };
+  static const char* names[NUM_COUNTERS];
+  uint64_t values[NUM_COUNTERS];
+  bool valid[NUM_COUNTERS];
+  string error; // razon por la que no hay contadores
+  PerfCounters();
+  ~PerfCounters();
+  bool available() const;
+  void start();
+  void stop();
+private:
+  int fd[NUM_COUNTERS];
+  uint64_t startv[NUM_COUNTERS];
+  bool read(int k, uint64_t& v);
+};
+
+
+#endif
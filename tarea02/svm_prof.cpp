@@ -0,0 +1,185 @@
+#include <iostream>
+#include <algorithm>
+
+#include "svm.hh"
+#include "svm_prof.hh"
+#include "svm_trace.hh"
+
+/* ******** Perfil (--profile) y traza (--trace) *********** */
+
+// Ciclo de despacho instrumentado sobre code (sin superinstrucciones), de
+// modo que los motores normales no pagan nada cuando el perfil y la traza
+// estan apagados y cada evento corresponde a una instruccion del programa
+// fuente. Hook recibe step() antes de cada instruccion y taken() en cada
+// salto tomado; como es un parametro de plantilla, las llamadas se expanden
+// en linea.
+template<class Hook>
+void ExecutionContext::run_hooked(Hook& hook) {
+  const Code* cp = prog.code.data();
+  int n = prog.code.size();
+  int top;
+  int* base = opstack.base();
+  int* sp = base + opstack.size();
+  int pc = this->pc; // local: las escrituras del hook no lo invalidan
+  while (pc < n) {
+    const Code& c = cp[pc];
+    hook.step(pc, c.op, sp > base ? sp[-1] : 0);
+    switch (c.op) {
+    case Instruction::IPUSH: *sp++ = c.arg; pc++; break;
+    case Instruction::IPOP: sp--; pc++; break;
+    case Instruction::IDUP: *sp = sp[-1]; sp++; pc++; break;
+    case Instruction::ISWAP:
+      top = sp[-1]; sp[-1] = sp[-2]; sp[-2] = top; pc++; break;
+    case Instruction::IADD: sp--; sp[-1] += *sp; pc++; break;
+    case Instruction::ISUB: sp--; sp[-1] -= *sp; pc++; break;
+    case Instruction::IMUL: sp--; sp[-1] *= *sp; pc++; break;
+    case Instruction::IDIV: sp--; sp[-1] = divide(sp[-1], *sp); pc++; break;
+    case Instruction::IGOTO: hook.taken(pc); pc = c.arg; break;
+    case Instruction::IJMPEQ: case Instruction::IJMPGT: case Instruction::IJMPGE:
+    case Instruction::IJMPLT: case Instruction::IJMPLE: {
+      bool jump;
+      sp -= 2;
+      switch (c.op) {
+      case Instruction::IJMPEQ: jump = sp[0] == sp[1]; break;
+      case Instruction::IJMPGT: jump = sp[0] > sp[1]; break;
+      case Instruction::IJMPGE: jump = sp[0] >= sp[1]; break;
+      case Instruction::IJMPLT: jump = sp[0] < sp[1]; break;
+      default: jump = sp[0] <= sp[1]; break;
+      }
+      if (jump) {
+	hook.taken(pc);
+	pc = c.arg;
+      } else
+	pc++;
+      break;
+    }
+    case Instruction::ISKIP: pc++; break;
+    case Instruction::ISTORE: sp--; registers[c.arg] = *sp; pc++; break;
+    case Instruction::ILOAD: *sp++ = registers[c.arg]; pc++; break;
+    case Instruction::IPRINT: opstack.resize(sp - base); print_stack(); pc++; break;
+    default: opstack.resize(sp - base); this->pc = pc; perror("Programming Error: run_hooked");
+    }
+  }
+  opstack.resize(sp - base);
+  this->pc = pc;
+}
+
+class ProfileHook {
+  uint64_t* cnt;
+  uint64_t* tk;
+public:
+  ProfileHook(Profile& prof):cnt(prof.count.data()),tk(prof.taken.data()) { }
+  void step(int pc, int op, int tos) { cnt[pc]++; }
+  void taken(int pc) { tk[pc]++; }
+};
+
+class TraceHook {
+  TraceBuffer* trace;
+public:
+  TraceHook(TraceBuffer* t):trace(t) { }
+  void step(int pc, int op, int tos) { trace->record(pc, op, tos); }
+  void taken(int pc) { }
+};
+
+void ExecutionContext::run_profile(Profile& prof) {
+  ProfileHook hook(prof);
+  run_hooked(hook);
+}
+
+void ExecutionContext::run_trace() {
+  TraceHook hook(trace);
+  run_hooked(hook);
+}
+
+void ExecutionContext::execute(Profile& prof) {
+  prof.reset(prog.code.size());
+  run_profile(prof);
+  for (int i=0; i < prof.count.size(); i++)
+    prof.total += prof.count[i];
+}
+
+static string itext(Instruction* s) {
+  string t = snames[s->type];
+  if (s->hasarg)
+    t += " " + (s->jmplabel == "" ? to_string(s->argint) : s->jmplabel);
+  return t;
+}
+
+// Un salto hacia atras (destino <= pc) que se toma cierra un ciclo
+struct BackEdge {
+  int from, to;
+  uint64_t count;
+  bool operator<(const BackEdge& o) const { return count > o.count; }
+};
+
+static vector<BackEdge> backEdges(const vector<Code>& code, const Profile& prof) {
+  vector<BackEdge> edges;
+  for (int i=0; i < code.size(); i++) {
+    if (!isJump(code[i].op) || code[i].arg > i || prof.taken[i] == 0) continue;
+    BackEdge e = { i, code[i].arg, prof.taken[i] };
+    edges.push_back(e);
+  }
+  stable_sort(edges.begin(), edges.end());
+  return edges;
+}
+
+void Program::print_profile(const Profile& prof) const {
+  side();
+  uint64_t ops[NUM_OPS] = { 0 };
+  for (int i=0; i < code.size(); i++)
+    ops[code[i].op] += prof.count[i];
+  cout << "Executed " << prof.total << " instructions" << endl;
+  cout << "By opcode:" << endl;
+  for (int op=0; op <= Instruction::IPRINT; op++)
+    if (ops[op] > 0) {
+      cout.width(12);
+      cout << ops[op] << "  " << snames[op] << endl;
+    }
+  vector<BackEdge> edges = backEdges(code, prof);
+  cout << "Hot loops:" << endl;
+  for (int k=0; k < edges.size() && k < 10; k++) {
+    const BackEdge& e = edges[k];
+    cout.width(12);
+    cout << e.count << "  " << itext(instructions[e.from]) << " (pc " << e.from
+	 << " -> " << e.to << ")" << endl;
+  }
+}
+
+// Reporte completo en JSON: contadores por instruccion, por opcode y los
+// saltos hacia atras ordenados por cantidad de iteraciones.
+void Program::profile_json(const Profile& prof, ostream& out) const {
+  side();
+  uint64_t ops[NUM_OPS] = { 0 };
+  for (int i=0; i < code.size(); i++)
+    ops[code[i].op] += prof.count[i];
+  out << "{" << endl;
+  out << "  \"instructions\": " << prof.total << "," << endl;
+  out << "  \"pcs\": [" << endl;
+  for (int i=0; i < code.size(); i++) {
+    Instruction* s = instructions[i];
+    out << "    { \"pc\": " << i << ", \"label\": \"" << s->label << "\", \"instr\": \""
+	<< itext(s) << "\", \"count\": " << prof.count[i];
+    if (isCondJump(code[i].op))
+      out << ", \"taken\": " << prof.taken[i] << ", \"not_taken\": " << prof.count[i] - prof.taken[i];
+    out << " }" << (i+1 < code.size() ? "," : "") << endl;
+  }
+  out << "  ]," << endl;
+  out << "  \"opcodes\": {";
+  bool first = true;
+  for (int op=0; op <= Instruction::IPRINT; op++) {
+    if (ops[op] == 0) continue;
+    out << (first ? " " : ", ") << "\"" << snames[op] << "\": " << ops[op];
+    first = false;
+  }
+  out << " }," << endl;
+  out << "  \"back_edges\": [" << endl;
+  vector<BackEdge> edges = backEdges(code, prof);
+  for (int k=0; k < edges.size(); k++) {
+    const BackEdge& e = edges[k];
+    out << "    { \"from\": " << e.from << ", \"to\": " << e.to << ", \"label\": \""
+	<< instructions[e.from]->jmplabel << "\", \"count\": " << e.count << " }"
+	<< (k+1 < edges.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl;
+  out << "}" << endl;
+}
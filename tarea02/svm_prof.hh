@@ -0,0 +1,26 @@
+#ifndef SVM_PROF
+#define SVM_PROF
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+
+// Contadores del modo --profile. Se indexan por pc de code, es decir por
+// instruccion del programa fuente (el perfil no usa las superinstrucciones).
+class Profile {
+public:
+  vector<uint64_t> count; // ejecuciones de cada instruccion
+  vector<uint64_t> taken; // saltos tomados (no tomados: count - taken)
+  uint64_t total;         // instrucciones ejecutadas
+  Profile():total(0) { }
+  void reset(int n) {
+    count.assign(n, 0);
+    taken.assign(n, 0);
+    total = 0;
+  }
+};
+
+
+#endif
@@ -0,0 +1,329 @@
+#include <iostream>
+#include <climits>
+
+#include "svm.hh"
+
+/* ******** Traduccion pila -> registros *********** */
+
+// Valor simbolico de un slot de la pila durante la traduccion: una constante
+// o el registro virtual donde esta el valor.
+struct ROpnd {
+  bool isconst;
+  int v;
+};
+
+// Traduce bloque a bloque manteniendo la pila simbolicamente: push y load
+// no generan codigo, solo las operaciones. Los slots se escriben en su
+// registro canonico (8+posicion) recien cuando hace falta: antes de un
+// label, un salto o un print, o cuando se va a sobrescribir un registro al
+// que todavia hace referencia algun slot.
+class RegTranslator {
+public:
+  vector<RCode>& out;
+  vector<ROpnd> st;
+  vector<bool> busy; // slots que se estan materializando (ciclos por swap)
+  int nslots;        // 8 + altura maxima; los temporales van despues
+  int ntemps;
+  int lastdst;       // ultima instruccion cuyo destino se puede redirigir, -1 si no
+  RegTranslator(vector<RCode>& out, int maxheight);
+  int slot(int j) { return 8+j; }
+  int emit(int op, int dst, int a, int b, int imm);
+  void writeVal(int d, ROpnd e);
+  void spillRefs(int x, int depth, int skip = INT_MAX);
+  void materialize(int j, int depth);
+  void flush(int upto);
+  void canonical(int h);
+  void binop(int op);
+  void store(int r);
+  void jump(int op, int target);
+};
+
+RegTranslator::RegTranslator(vector<RCode>& out, int maxheight):out(out),nslots(8+maxheight),ntemps(0),lastdst(-1) {
+  busy.assign(maxheight+1, false);
+}
+
+int RegTranslator::emit(int op, int dst, int a, int b, int imm) {
+  RCode r;
+  r.op = op; r.dst = dst; r.a = a; r.b = b; r.imm = imm; r.target = 0;
+  out.push_back(r);
+  lastdst = -1;
+  return out.size()-1;
+}
+
+void RegTranslator::writeVal(int d, ROpnd e) {
+  if (e.isconst)
+    emit(RCode::RMOVI, d, 0, 0, e.v);
+  else if (e.v != d)
+    emit(RCode::RMOV, d, e.v, 0, 0);
+}
+
+// Antes de escribir el registro x, los slots vivos que todavia lo leen se
+// materializan en su propio registro (o en un temporal si forman un ciclo).
+// Los slots desde skip son operandos de la instruccion que escribe x: se leen
+// antes de la escritura, pero siguen visibles para las escrituras anidadas.
+void RegTranslator::spillRefs(int x, int depth, int skip) {
+  for (int j=0; j < st.size() && j < skip; j++) {
+    if (st[j].isconst || st[j].v != x || slot(j) == x) continue;
+    if (busy[j]) {
+      int t = nslots + depth;
+      if (depth+1 > ntemps) ntemps = depth+1;
+      emit(RCode::RMOV, t, x, 0, 0);
+      st[j].v = t;
+    } else
+      materialize(j, depth+1);
+  }
+}
+
+void RegTranslator::materialize(int j, int depth) {
+  if (!st[j].isconst && st[j].v == slot(j)) return;
+  busy[j] = true;
+  spillRefs(slot(j), depth);
+  writeVal(slot(j), st[j]);
+  busy[j] = false;
+  st[j].isconst = false;
+  st[j].v = slot(j);
+}
+
+void RegTranslator::flush(int upto) {
+  for (int j=0; j < upto; j++)
+    materialize(j, 0);
+  lastdst = -1;
+}
+
+void RegTranslator::canonical(int h) {
+  st.resize(h);
+  for (int j=0; j < h; j++) {
+    st[j].isconst = false;
+    st[j].v = slot(j);
+  }
+  lastdst = -1;
+}
+
+void RegTranslator::binop(int op) {
+  int h = st.size();
+  int d = slot(h-2);
+  ROpnd r;
+  if (st[h-2].isconst && st[h-1].isconst &&
+      (op != Instruction::IDIV || (st[h-1].v != 0 && !(st[h-2].v == INT_MIN && st[h-1].v == -1)))) {
+    ROpnd b = st.back(); st.pop_back();
+    ROpnd a = st.back(); st.pop_back();
+    unsigned x = a.v, y = b.v;
+    r.isconst = true;
+    switch (op) {
+    case Instruction::IADD: r.v = (int) (x+y); break;
+    case Instruction::ISUB: r.v = (int) (x-y); break;
+    case Instruction::IMUL: r.v = (int) (x*y); break;
+    default: r.v = a.v / b.v;
+    }
+    st.push_back(r);
+    return;
+  }
+  int rop, ropi;
+  switch (op) {
+  case Instruction::IADD: rop = RCode::RADD; ropi = RCode::RADDI; break;
+  case Instruction::ISUB: rop = RCode::RSUB; ropi = RCode::RSUBI; break;
+  case Instruction::IMUL: rop = RCode::RMUL; ropi = RCode::RMULI; break;
+  default: rop = RCode::RDIV; ropi = RCode::RDIVI;
+  }
+  spillRefs(d, 0, h-2);
+  ROpnd b = st.back(); st.pop_back();
+  ROpnd a = st.back(); st.pop_back();
+  int k;
+  if (!a.isconst && !b.isconst)
+    k = emit(rop, d, a.v, b.v, 0);
+  else if (!a.isconst)
+    k = emit(ropi, d, a.v, 0, b.v);
+  else if (b.isconst) { // division por cero constante: se deja para tiempo de ejecucion
+    int t = nslots;
+    if (ntemps < 1) ntemps = 1;
+    emit(RCode::RMOVI, t, 0, 0, a.v);
+    k = emit(ropi, d, t, 0, b.v);
+  } else if (op == Instruction::IADD || op == Instruction::IMUL)
+    k = emit(ropi, d, b.v, 0, a.v);
+  else {
+    int t = nslots;
+    if (ntemps < 1) ntemps = 1;
+    emit(RCode::RMOVI, t, 0, 0, a.v);
+    k = emit(rop, d, t, b.v, 0);
+  }
+  lastdst = k;
+  r.isconst = false;
+  r.v = d;
+  st.push_back(r);
+}
+
+void RegTranslator::store(int r) {
+  int h = st.size();
+  ROpnd e = st.back();
+  if (!e.isconst && e.v == r) { // load r; store r
+    st.pop_back();
+    return;
+  }
+  bool retarget = (lastdst >= 0 && !e.isconst && e.v >= 8 && out[lastdst].dst == e.v);
+  for (int j=0; retarget && j < h-1; j++)
+    if (!st[j].isconst && (st[j].v == e.v || st[j].v == r)) retarget = false;
+  if (retarget) {
+    // el resultado de la ultima operacion va directo al registro
+    out[lastdst].dst = r;
+    lastdst = -1;
+    st.pop_back();
+    return;
+  }
+  spillRefs(r, 0, h-1);
+  e = st.back(); st.pop_back();
+  writeVal(r, e);
+}
+
+static int mirror(int op) {
+  switch (op) {
+  case Instruction::IJMPGT: return Instruction::IJMPLT;
+  case Instruction::IJMPGE: return Instruction::IJMPLE;
+  case Instruction::IJMPLT: return Instruction::IJMPGT;
+  case Instruction::IJMPLE: return Instruction::IJMPGE;
+  default: return op;
+  }
+}
+
+static bool compare(int op, int a, int b) {
+  switch (op) {
+  case Instruction::IJMPEQ: return a == b;
+  case Instruction::IJMPGT: return a > b;
+  case Instruction::IJMPGE: return a >= b;
+  case Instruction::IJMPLT: return a < b;
+  default: return a <= b;
+  }
+}
+
+void RegTranslator::jump(int op, int target) {
+  if (op == Instruction::IGOTO) {
+    flush(st.size());
+    emit(RCode::RGOTO, 0, 0, 0, 0);
+    out.back().target = target;
+    return;
+  }
+  flush(st.size()-2);
+  ROpnd b = st.back(); st.pop_back();
+  ROpnd a = st.back(); st.pop_back();
+  int cond = op - Instruction::IJMPEQ;
+  if (a.isconst && b.isconst) {
+    if (compare(op, a.v, b.v)) {
+      emit(RCode::RGOTO, 0, 0, 0, 0);
+      out.back().target = target;
+    }
+    return;
+  }
+  if (!a.isconst && !b.isconst)
+    emit(RCode::RJEQ + cond, 0, a.v, b.v, 0);
+  else if (!a.isconst)
+    emit(RCode::RJEQI + cond, 0, a.v, 0, b.v);
+  else
+    emit(RCode::RJEQI + (mirror(op) - Instruction::IJMPEQ), 0, b.v, 0, a.v);
+  out.back().target = target;
+}
+
+// Traduce code (ya verificado) a la forma de registros. Devuelve false si
+// el programa necesita mas registros virtuales de los que caben en RCode.
+bool Program::translate(vector<RCode>& rcode, int& nvregs) const {
+  int n = code.size();
+  rcode.clear();
+  RegTranslator t(rcode, maxheight);
+  vector<bool> leader(n+1, false);
+  for (int i=0; i < n; i++)
+    if (height[i] != -1 && isJump(code[i].op)) leader[code[i].arg] = true;
+  vector<int> rpc(n+1, 0);
+  bool live = false; // se llega a la instruccion actual cayendo desde la anterior
+  for (int i=0; i < n; i++) {
+    if (height[i] == -1) {
+      live = false;
+      continue;
+    }
+    if (i == 0 || leader[i] || !live) {
+      if (live) t.flush(t.st.size());
+      t.canonical(height[i]);
+    }
+    rpc[i] = rcode.size();
+    live = true;
+    const Code& c = code[i];
+    ROpnd e;
+    switch (c.op) {
+    case Instruction::IPUSH:
+      e.isconst = true; e.v = c.arg; t.st.push_back(e); break;
+    case Instruction::ILOAD:
+      e.isconst = false; e.v = c.arg; t.st.push_back(e); break;
+    case Instruction::IPOP: t.st.pop_back(); break;
+    case Instruction::IDUP: t.st.push_back(t.st.back()); break;
+    case Instruction::ISWAP: swap(t.st[t.st.size()-1], t.st[t.st.size()-2]); break;
+    case Instruction::IADD: case Instruction::ISUB:
+    case Instruction::IMUL: case Instruction::IDIV:
+      t.binop(c.op); break;
+    case Instruction::ISTORE: t.store(c.arg); break;
+    case Instruction::ISKIP: break;
+    case Instruction::IPRINT:
+      t.flush(t.st.size());
+      t.emit(RCode::RPRINT, 0, 0, 0, t.st.size());
+      break;
+    default: // saltos
+      t.jump(c.op, c.arg);
+      if (c.op == Instruction::IGOTO) live = false;
+    }
+  }
+  if (live) t.flush(t.st.size());
+  rpc[n] = rcode.size();
+  for (int k=0; k < rcode.size(); k++)
+    if (rcode[k].op >= RCode::RGOTO && rcode[k].op <= RCode::RJLEI)
+      rcode[k].target = rpc[rcode[k].target];
+  nvregs = t.nslots + t.ntemps;
+  return nvregs <= 65536;
+}
+
+// Interprete de la forma de registros. Si el programa no se puede traducir
+// se usa el motor threaded.
+void ExecutionContext::run_register() {
+  vector<RCode> rcode;
+  int nvregs;
+  if (pc != 0 || !prog.translate(rcode, nvregs)) {
+    run_threaded();
+    return;
+  }
+  vector<int> vregs(nvregs, 0);
+  int* v = vregs.data();
+  for (int r=0; r < 8; r++) v[r] = registers[r];
+  const RCode* rc = rcode.data();
+  const RCode* ip = rc;
+  const RCode* end = rc + rcode.size();
+  while (ip < end) {
+    switch (ip->op) {
+    case RCode::RMOV: v[ip->dst] = v[ip->a]; ip++; break;
+    case RCode::RMOVI: v[ip->dst] = ip->imm; ip++; break;
+    case RCode::RADD: v[ip->dst] = v[ip->a] + v[ip->b]; ip++; break;
+    case RCode::RADDI: v[ip->dst] = v[ip->a] + ip->imm; ip++; break;
+    case RCode::RSUB: v[ip->dst] = v[ip->a] - v[ip->b]; ip++; break;
+    case RCode::RSUBI: v[ip->dst] = v[ip->a] - ip->imm; ip++; break;
+    case RCode::RMUL: v[ip->dst] = v[ip->a] * v[ip->b]; ip++; break;
+    case RCode::RMULI: v[ip->dst] = v[ip->a] * ip->imm; ip++; break;
+    case RCode::RDIV: v[ip->dst] = divide(v[ip->a], v[ip->b]); ip++; break;
+    case RCode::RDIVI: v[ip->dst] = divide(v[ip->a], ip->imm); ip++; break;
+    case RCode::RGOTO: ip = rc + ip->target; break;
+    case RCode::RJEQ: ip = (v[ip->a] == v[ip->b]) ? rc + ip->target : ip+1; break;
+    case RCode::RJGT: ip = (v[ip->a] > v[ip->b]) ? rc + ip->target : ip+1; break;
+    case RCode::RJGE: ip = (v[ip->a] >= v[ip->b]) ? rc + ip->target : ip+1; break;
+    case RCode::RJLT: ip = (v[ip->a] < v[ip->b]) ? rc + ip->target : ip+1; break;
+    case RCode::RJLE: ip = (v[ip->a] <= v[ip->b]) ? rc + ip->target : ip+1; break;
+    case RCode::RJEQI: ip = (v[ip->a] == ip->imm) ? rc + ip->target : ip+1; break;
+    case RCode::RJGTI: ip = (v[ip->a] > ip->imm) ? rc + ip->target : ip+1; break;
+    case RCode::RJGEI: ip = (v[ip->a] >= ip->imm) ? rc + ip->target : ip+1; break;
+    case RCode::RJLTI: ip = (v[ip->a] < ip->imm) ? rc + ip->target : ip+1; break;
+    case RCode::RJLEI: ip = (v[ip->a] <= ip->imm) ? rc + ip->target : ip+1; break;
+    case RCode::RPRINT:
+      opstack.resize(0);
+      for (int j=0; j < ip->imm; j++) opstack.push(v[8+j]);
+      print_stack();
+      ip++; break;
+    default: perror("Programming Error: run_register");
+    }
+  }
+  for (int r=0; r < 8; r++) registers[r] = v[r];
+  opstack.resize(0);
+  for (int j=0; j < prog.exitheight; j++) opstack.push(v[8+j]);
+  pc = prog.code.size();
+}
@@ -2,53 +2,280 @@
 #include <iostream>
 #include <stdlib.h>
 #include <cstring>
+#include <cerrno>
 #include <fstream>
 
 
 #include "svm_parser.hh"
 #include "svm.hh"
+#include "svm_opt.hh"
+#include "svm_cfg.hh"
+#include "svm_prof.hh"
+#include "svm_perf.hh"
+#include "svm_trace.hh"
+#include "svm_batch.hh"
+#include "svm_image.hh"
+#include "svm_cache.hh"
+#include "svm_source.hh"
 
 
-int main(int argc, const char* argv[]) {
+static void printCounters(const char* phase, const PerfCounters& pc) {
+  cout.width(10);
+  cout << left << phase << right;
+  for (int k=0; k < PerfCounters::NUM_COUNTERS; k++) {
+    cout.width(16);
+    if (pc.valid[k]) cout << pc.values[k];
+    else cout << "n/a";
+  }
+  cout << endl;
+}
+
+// Fases medidas con --perf-counters: parser, construccion del SVM
+// (labels, verificacion, superinstrucciones) y ejecucion. vminstr es la
+// cantidad de instrucciones del SVM ejecutadas (0: desconocida); separate
+// indica que se conto en una segunda ejecucion y no en la medida; profiled,
+// que la ejecucion medida fue la de --profile y no la del motor elegido.
+static void perfReport(PerfCounters* phases[3], uint64_t vminstr, bool separate, bool profiled) {
+  static const char* phase_names[3] = { "parse", "load", "execute" };
+  if (!phases[2]->available()) {
+    cout << "Performance counters not available (" << phases[2]->error << ")" << endl;
+    return;
+  }
+  cout << "Performance counters:" << endl;
+  cout.width(10);
+  cout << left << "phase" << right;
+  for (int k=0; k < PerfCounters::NUM_COUNTERS; k++) {
+    cout.width(16);
+    cout << PerfCounters::names[k];
+  }
+  cout << endl;
+  for (int p=0; p < 3; p++)
+    printCounters(phase_names[p], *phases[p]);
+  if (profiled)
+    cout << "(execute measured the --profile loop, not the selected engine)" << endl;
+  if (vminstr == 0) {
+    cout << "Per VM instruction: needs --profile or --perf-counters=per-instruction" << endl;
+    return;
+  }
+  cout << "Per VM instruction (" << vminstr << " executed"
+       << (separate ? ", counted in a separate profiled run" : "") << "):" << endl;
+  const PerfCounters& ex = *phases[2];
+  for (int k=0; k < PerfCounters::NUM_COUNTERS; k++)
+    if (ex.valid[k])
+      cout << "  " << PerfCounters::names[k] << ": " << (double) ex.values[k] / vminstr << endl;
+  if (ex.valid[PerfCounters::CYCLES] && ex.valid[PerfCounters::INSTRUCTIONS] && ex.values[PerfCounters::CYCLES] > 0)
+    cout << "  IPC: " << (double) ex.values[PerfCounters::INSTRUCTIONS] / ex.values[PerfCounters::CYCLES] << endl;
+}
+
+// Entradas de --sweep: una instancia por linea con los valores iniciales de
+// r0..r7 separados por comas (los que faltan quedan en 0). Las lineas
+// vacias, los comentarios (#) y un encabezado no numerico se ignoran.
+static void readSweep(istream& in, vector<vector<int> >& inputs) {
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    if (!isdigit(line[0]) && line[0] != '-' && line[0] != '+' && line[0] != ' ') continue;
+    vector<int> regs;
+    std::stringstream ls(line);
+    string field;
+    while (getline(ls, field, ',') && regs.size() < 8)
+      regs.push_back(atoi(field.c_str()));
+    inputs.push_back(regs);
+  }
+}
+
+// Argumento de system() entre comillas simples
+static string shellQuote(const string& s) {
+  string q = "'";
+  for (size_t i=0; i < s.size(); i++)
+    if (s[i] == '\'') q += "'\\''";
+    else q += s[i];
+  return q + "'";
+}
+
+static TraceBuffer* trace = NULL; // --trace
+
+static int run(int argc, const char* argv[]) {
 
   bool useparser = true;
   SVM* svm;
+  SVM::Engine engine = SVM::ENGINE_THREADED;
+  const char* fname = NULL;
+  int maxdepth = SVM::DEFAULT_STACK;
+  string cfile, exefile; // --svm2c
+  string dotfile;
+  string proffile; // --profile
+  PerfCounters* phases[3] = { NULL, NULL, NULL }; // --perf-counters
+  bool perinstr = false; // --perf-counters=per-instruction
+  int tracesize = 0; // --trace
+  string sweepfile, sweepout; // --sweep
+  string batchpath; // --batch
+  int nthreads = 0;
+  bool compile = false, image = false; // --compile, programa en imagen binaria
+  string imagefile; // -o
+  string cachedir; // --cache
+  uint64_t cachesize = ImageCache::DEFAULT_SIZE;
+  ImageCache* cache = NULL;
+  Program* cached = NULL; // programa encontrado en el cache
+  string cachekey;
+  bool fromstdin = false; // programa "-"
+  bool optimize = false;
+  list<Instruction*> sl;
+
+  for (int i=1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg.compare(0, 9, "--engine=") == 0) {
+      if (!SVM::engineFromName(arg.substr(9), engine)) {
+	cout << "Unknown engine " << arg.substr(9) << " (classic, switch, goto, threaded, register, jit)" << endl;
+	exit(1);
+      }
+    } else if (arg.compare(0, 6, "--dot=") == 0) {
+      dotfile = arg.substr(6);
+    } else if (arg == "--profile") {
+      proffile = "profile.json";
+    } else if (arg.compare(0, 10, "--profile=") == 0) {
+      proffile = arg.substr(10);
+    } else if (arg.compare(0, 8, "--sweep=") == 0) {
+      sweepfile = arg.substr(8);
+    } else if (arg.compare(0, 12, "--sweep-out=") == 0) {
+      sweepout = arg.substr(12);
+    } else if (arg.compare(0, 8, "--batch=") == 0) {
+      batchpath = arg.substr(8);
+    } else if (arg == "--batch" && i+1 < argc) {
+      batchpath = argv[++i];
+    } else if (arg.compare(0, 10, "--threads=") == 0) {
+      nthreads = atoi(arg.c_str()+10);
+      if (nthreads <= 0) {
+	cout << "Invalid thread count " << arg.substr(10) << endl;
+	exit(1);
+      }
+    } else if (arg == "--trace") {
+      tracesize = TraceBuffer::DEFAULT_SIZE;
+    } else if (arg.compare(0, 8, "--trace=") == 0) {
+      tracesize = atoi(arg.c_str()+8);
+      if (tracesize <= 0) {
+	cout << "Invalid trace size " << arg.substr(8) << endl;
+	exit(1);
+      }
+    } else if (arg == "--perf-counters" || arg == "--perf-counters=per-instruction") {
+      perinstr = perinstr || arg != "--perf-counters";
+      for (int p=0; p < 3; p++)
+	if (phases[p] == NULL) phases[p] = new PerfCounters();
+    } else if (arg == "-O") {
+      optimize = true;
+    } else if (arg == "--jit") {
+      engine = SVM::ENGINE_JIT;
+    } else if (arg.compare(0, 8, "--cache=") == 0) {
+      cachedir = arg.substr(8);
+    } else if (arg.compare(0, 13, "--cache-size=") == 0) {
+      // en MB, de 1 a 2^20 (1 TB); un valor invalido no puede dejar el cache sin limite
+      const char* s = arg.c_str()+13;
+      char* end;
+      errno = 0;
+      long mb = strtol(s, &end, 10);
+      if (end == s || *end != '\0' || errno != 0 || mb <= 0 || mb > (1L << 20)) {
+	cout << "Invalid cache size " << arg.substr(13) << endl;
+	exit(1);
+      }
+      cachesize = (uint64_t) mb << 20;
+    } else if (arg == "--compile") {
+      compile = true;
+    } else if (arg == "-o" && i+1 < argc) {
+      imagefile = argv[++i];
+    } else if (arg.compare(0, 8, "--svm2c=") == 0) {
+      cfile = arg.substr(8);
+    } else if (arg.compare(0, 5, "--cc=") == 0) {
+      exefile = arg.substr(5);
+    } else if (arg.compare(0, 13, "--stack-size=") == 0) {
+      maxdepth = atoi(arg.c_str()+13);
+      if (maxdepth <= 0) {
+	cout << "Invalid stack size " << arg.substr(13) << endl;
+	exit(1);
+      }
+    } else
+      fname = argv[i];
+  }
+
+  // --dot necesita las instrucciones: con un acierto no habria parser
+  if (cachedir != "" && dotfile == "")
+    cache = new ImageCache(cachedir, cachesize);
+
+  if (batchpath != "") {
+    vector<string> files;
+    if (!Batch::listFiles(batchpath, files)) {
+      cout << "Can't read " << batchpath << endl;
+      exit(1);
+    }
+    Batch batch;
+    batch.engine = engine;
+    batch.maxdepth = maxdepth;
+    batch.optimize = optimize;
+    batch.nthreads = nthreads;
+    batch.cache = cache;
+    batch.run(files, cout);
+    cout << "Batch: " << files.size() << " programs, " << batch.failed << " failed" << endl;
+    exit(0);
+  }
 
-  if (useparser) {
+  image = fname != NULL && Image::isImage(fname);
+  if (image) {
+    if (compile || optimize || dotfile != "") {
+      cout << "--compile, -O and --dot need a source program" << endl;
+      exit(1);
+    }
+    cout << "Reading image from file " << fname << endl;
+  } else if (useparser) {
   
-  if (argc != 2) {
+  if (fname == NULL) {
     cout << "File name missing" << endl;
     exit(1);
   }
-  cout << "Reading program from file " << argv[1] << endl;
-  std::ifstream t(argv[1]);
-  std::stringstream buffer;
-  buffer << t.rdbuf();
+  fromstdin = string(fname) == "-";
+  cout << "Reading program from " << (fromstdin ? "standard input" : "file " + string(fname)) << endl;
+  // el archivo se mapea y el Scanner lo lee en su lugar; stdin se lee por bloques
+  MappedFile source;
+  if (!fromstdin && !source.open(fname)) {
+    cout << "Can't read " << fname << endl;
+    exit(1);
+  }
 
-  // our scanner takes strings
-  Scanner scanner(buffer.str());
-  
-  Parser parser(&scanner);
-  svm = parser.parse();
+  if (cache != NULL && !fromstdin) {
+    uint32_t options = 0;
+    if (optimize)
+      options = ImageCache::OPTIMIZE | (sweepfile != "" ? ImageCache::OPEN_REGISTERS : 0);
+    cachekey = cache->key(source.data(), source.size(), options);
+    cached = cache->lookup(cachekey);
+    if (cached != NULL)
+      cout << "Loaded from cache " << cache->path(cachekey) << endl;
+  }
+
+  if (cached == NULL) {
+  if (phases[0]) phases[0]->start();
+  if (fromstdin) {
+    Scanner* scanner = new Scanner(0);
+    Parser parser(scanner);
+    parser.parse(sl);
+    delete scanner;
+  } else // un archivo grande se parsea por pedazos en paralelo (--threads)
+    Parser::parseParallel(source.data(), source.size(), sl, nthreads);
+  if (phases[0]) phases[0]->stop();
+  }
 
   // test scanner
 
   /*
-  Token* tk = scanner.nextToken();
-  while (tk->type != Token::END) {
+  Token tk = scanner->nextToken();
+  while (tk.type != Token::END) {
     cout << "next token " << tk << endl;
-    delete tk;
-    tk =  scanner.nextToken();
+    tk =  scanner->nextToken();
   }
   cout << "last token " << tk << endl;
-  delete tk;
   */
  
 
 
   } else {
 
-    list<Instruction*> sl;
     // programa 1
 
     sl.push_back(new Instruction("",Instruction::IPUSH, 30));
@@ -81,24 +308,147 @@ int main(int argc, const char* argv[]) {
     sl.push_back(new Instruction("",Instruction::IGOTO, "LENTRY"));
     sl.push_back(new Instruction("LEND",Instruction::ISKIP));
      */
-    
-    svm = new SVM(sl);
 
   }
+
+  if (optimize && cached == NULL) {
+    Optimizer opt(sweepfile != "");
+    opt.optimize(sl);
+    cout << "Peephole: removed " << opt.removed << " instructions" << endl;
+    cout << "Constant folding: " << opt.folded << " rewrites" << endl;
+    cout << "CFG: removed " << opt.unreachable << " unreachable instructions" << endl;
+  }
+  if (dotfile != "") {
+    CFG cfg(sl);
+    std::ofstream dout(dotfile.c_str());
+    cfg.dot(dout);
+    cout << "CFG written to " << dotfile << endl;
+  }
+  if (phases[1]) phases[1]->start();
+  if (image)
+    svm = new SVM(Image::load(fname), maxdepth);
+  else if (cached != NULL)
+    svm = new SVM(cached, maxdepth);
+  else
+    svm = new SVM(sl, maxdepth);
+  if (phases[1]) phases[1]->stop();
+  if (cache != NULL && cached == NULL && !image && !fromstdin) {
+    cache->store(cachekey, svm->program());
+    cout << "Stored in cache " << cache->path(cachekey) << endl;
+  }
+
+  if (compile) {
+    if (imagefile == "") {
+      imagefile = fname;
+      if (imagefile.size() > 4 && imagefile.compare(imagefile.size()-4, 4, ".svm") == 0)
+	imagefile.resize(imagefile.size()-4);
+      imagefile += ".svbc";
+    }
+    std::ofstream iout(imagefile.c_str(), ios::binary);
+    Image::write(svm->program(), iout);
+    iout.close();
+    if (!iout) {
+      cout << "Can't write " << imagefile << endl;
+      exit(1);
+    }
+    cout << "Image written to " << imagefile << endl;
+    exit(0);
+  }
   
+  if (cfile != "") {
+    std::ofstream cout_c(cfile.c_str());
+    svm->emit_c(cout_c);
+    cout_c.close();
+    cout << "C program written to " << cfile << endl;
+    if (exefile != "") {
+      string cmd = "cc -O2 -o " + shellQuote(exefile) + " " + shellQuote(cfile);
+      cout << cmd << endl;
+      if (system(cmd.c_str()) != 0) {
+	cout << "C compilation failed" << endl;
+	exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  if (sweepfile != "") {
+    std::ifstream sin(sweepfile.c_str());
+    if (!sin) {
+      cout << "Can't read " << sweepfile << endl;
+      exit(1);
+    }
+    vector<vector<int> > inputs;
+    readSweep(sin, inputs);
+    if (sweepout == "")
+      svm->sweep(inputs, cout);
+    else {
+      std::ofstream sout(sweepout.c_str());
+      svm->sweep(inputs, sout);
+      cout << "Sweep: " << inputs.size() << " instances written to " << sweepout << endl;
+    }
+    exit(0);
+  }
+
   cout << "Program:" << endl;
   svm->print();
   cout << "----------------" << endl;
 
   
+  if (tracesize > 0) {
+    trace = new TraceBuffer(tracesize);
+    trace->installSignals();
+    svm->set_trace(trace);
+    // goto, register y jit no registran la traza y corren como el threaded
+    // (ExecutionContext::execute); el motor por omision ya es el threaded
+    if (engine == SVM::ENGINE_GOTO || engine == SVM::ENGINE_REGISTER || engine == SVM::ENGINE_JIT)
+      cout << "Warning: --trace runs the " << SVM::engine_names[engine]
+	   << " engine as the threaded engine" << endl;
+  }
+
   cout << "Running ...." << endl;
-  svm->execute();
+  Profile prof;
+  if (phases[2]) phases[2]->start();
+  if (proffile != "")
+    svm->execute(prof);
+  else
+    svm->execute(engine);
+  if (phases[2]) phases[2]->stop();
   cout << "Finished" << endl;
 
   svm->print_stack();
-  
 
-  
-  
-  
+  if (proffile != "") {
+    cout << "Profile:" << endl;
+    svm->print(&prof);
+    svm->print_profile(prof);
+    std::ofstream pout(proffile.c_str());
+    svm->profile_json(prof, pout);
+    cout << "Profile written to " << proffile << endl;
+  }
+
+  if (phases[2]) {
+    uint64_t vminstr = prof.total;
+    bool separate = proffile == "" && perinstr && phases[2]->available();
+    if (separate) {
+      // los motores no cuentan instrucciones: solo si se pide, se repite la
+      // ejecucion con el perfil y sin salida para obtener la cantidad
+      ExecutionContext counter(svm->program(), maxdepth);
+      std::ofstream null;
+      counter.set_output(null);
+      counter.execute(prof);
+      vminstr = prof.total;
+    }
+    perfReport(phases, vminstr, separate, proffile != "");
+  }
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  try {
+    return run(argc, argv);
+  } catch (SVMError& e) {
+    cout << e.what() << endl;
+    if (trace != NULL) trace->dump(1);
+    exit(0);
+  }
 }
@@ -0,0 +1,33 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "svm_source.hh"
+
+/* ******** Carga de archivos con mmap *********** */
+
+MappedFile::~MappedFile() {
+  if (length > 0) munmap((void*) bytes, length);
+}
+
+bool MappedFile::open(const string& fname) {
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) { // mmap no acepta largo 0
+    close(fd);
+    return true;
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+  madvise(p, st.st_size, MADV_SEQUENTIAL); // se recorre una vez, en orden
+  bytes = (const char*) p;
+  length = st.st_size;
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef SVM_SOURCE
+#define SVM_SOURCE
+
+#include <string>
+#include <cstddef>
+
+using namespace std;
+
+
+// Archivo mapeado en memoria de solo lectura (mmap). El Scanner y el
+// cargador de imagenes leen los bytes directamente, sin copiarlos.
+class MappedFile {
+  const char* bytes;
+  size_t length;
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+public:
+  MappedFile():bytes(NULL),length(0) { }
+  ~MappedFile();
+  // Devuelve false si no se puede abrir. Un archivo vacio da size() == 0.
+  bool open(const string& fname);
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+};
+
+
+#endif
@@ -0,0 +1,225 @@
+#include <iostream>
+#include <sstream>
+#include <climits>
+
+#include "svm.hh"
+
+/* ******** Barrido en paralelo (--sweep) *********** */
+
+// Ejecuta el mismo programa para muchas entradas, de a LANES instancias en
+// lockstep: cada slot de la pila y cada registro es un vector con un valor
+// por instancia (AVX2 cuando el procesador lo tiene). Como el programa esta
+// verificado, la altura de la pila en cada pc es la misma para todas las
+// instancias, asi que comparten los indices de la pila.
+//
+// Las instancias que estan en el mismo pc forman un grupo (una mascara). Un
+// salto condicional en el que el grupo no esta de acuerdo lo divide en dos;
+// siempre se ejecuta el grupo de menor pc y dos grupos que llegan al mismo
+// pc se juntan de nuevo. Todas las escrituras respetan la mascara del grupo,
+// porque los demas grupos usan los mismos slots.
+
+// Alineados a 4: los vectores viven en memoria reservada por codigo
+// compilado sin AVX (alineada a 16), asi que los accesos no pueden suponer
+// 32 bytes de alineamiento.
+static const int LANES = 8;
+typedef int32_t lanes_t __attribute__((vector_size(4*LANES), aligned(4)));
+typedef uint32_t ulanes_t __attribute__((vector_size(4*LANES), aligned(4)));
+
+struct LaneGroup {
+  int pc;
+  lanes_t mask; // -1: la instancia pertenece al grupo
+};
+
+// Instruccion con la altura de la pila ya resuelta
+struct LaneOp {
+  int32_t op, h, arg, pad;
+};
+
+// a en las instancias de la mascara m, b en las demas
+#define blend(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+typedef uint64_t qlanes_t __attribute__((vector_size(4*LANES), aligned(4)));
+
+static inline bool none(const lanes_t& m) {
+  qlanes_t q = (qlanes_t) m;
+  return (q[0] | q[1] | q[2] | q[3]) == 0;
+}
+
+static inline bool same(const lanes_t& a, const lanes_t& b) {
+  return none(a ^ b);
+}
+
+// Version AVX2 elegida al cargar cuando el procesador la tiene
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define SWEEP_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SWEEP_CLONES
+#endif
+
+// Ejecuta el grupo g mientras su pc sea menor que limit. Devuelve false si
+// el grupo se dividio (el nuevo grupo queda en split). Las instancias que
+// dividen por cero salen de la mascara y se anotan en failed. Sin MASKED
+// las escrituras cubren todas las instancias: solo sirve cuando g es el
+// unico grupo (las demas instancias ya terminaron o fallaron).
+template<bool MASKED>
+SWEEP_CLONES
+static bool runGroup(const LaneOp* lp, lanes_t* S, lanes_t* R, LaneGroup& g, int limit,
+	      LaneGroup& split, int* failed) {
+  static_assert(Instruction::IPRINT == 17, "tabla de despacho");
+  void* labels[18] = { &&L_PUSH, &&L_POP, &&L_DUP, &&L_SWAP, &&L_ADD, &&L_SUB, &&L_MUL, &&L_DIV,
+		       &&L_GOTO, &&L_JMP, &&L_JMP, &&L_JMP, &&L_JMP, &&L_JMP,
+		       &&L_SKIP, &&L_STORE, &&L_LOAD, &&L_SKIP }; // print no imprime en el barrido
+  int pc = g.pc;
+  lanes_t m = g.mask;
+  bool divided = false;
+  int h;
+#define PUT(d, v) (d) = MASKED ? blend(m, (v), (d)) : (v)
+#define DISPATCH if (pc >= limit) goto L_END; h = lp[pc].h; goto *labels[lp[pc].op]
+#define NEXT pc++; DISPATCH
+  DISPATCH;
+ L_PUSH: PUT(S[h], (lanes_t) {} + lp[pc].arg); NEXT;
+ L_POP: NEXT;
+ L_DUP: PUT(S[h], S[h-1]); NEXT;
+ L_SWAP: {
+    lanes_t a = S[h-1], b = S[h-2];
+    PUT(S[h-1], b);
+    PUT(S[h-2], a);
+    NEXT;
+  }
+ L_ADD: PUT(S[h-2], (lanes_t) ((ulanes_t) S[h-2] + (ulanes_t) S[h-1])); NEXT;
+ L_SUB: PUT(S[h-2], (lanes_t) ((ulanes_t) S[h-2] - (ulanes_t) S[h-1])); NEXT;
+ L_MUL: PUT(S[h-2], (lanes_t) ((ulanes_t) S[h-2] * (ulanes_t) S[h-1])); NEXT;
+ L_DIV: {
+    // no hay division entera vectorial: por instancia, y solo las activas
+    lanes_t a = S[h-2], d = S[h-1];
+    for (int k=0; k < LANES; k++) {
+      if (!m[k]) continue;
+      if (d[k] == 0 || (a[k] == INT_MIN && d[k] == -1)) {
+	failed[k] = pc;
+	m[k] = 0;
+      } else
+	a[k] = a[k] / d[k];
+    }
+    S[h-2] = a;
+    pc++;
+    if (none(m)) goto L_END; // no queda nadie en el grupo
+    DISPATCH;
+  }
+ L_GOTO: pc = lp[pc].arg; DISPATCH;
+ L_JMP: {
+    lanes_t a = S[h-2], b = S[h-1], t;
+    switch (lp[pc].op) {
+    case Instruction::IJMPEQ: t = a == b; break;
+    case Instruction::IJMPGT: t = a > b; break;
+    case Instruction::IJMPGE: t = a >= b; break;
+    case Instruction::IJMPLT: t = a < b; break;
+    default: t = a <= b; break;
+    }
+    t &= m;
+    if (none(t)) {
+      NEXT;
+    }
+    if (same(t, m)) {
+      pc = lp[pc].arg;
+      DISPATCH;
+    }
+    split.pc = lp[pc].arg;
+    split.mask = t;
+    m &= ~t;
+    pc++;
+    divided = true;
+    goto L_END;
+  }
+ L_SKIP: NEXT;
+ L_STORE: PUT(R[lp[pc].arg], S[h-1]); NEXT;
+ L_LOAD: PUT(S[h], R[lp[pc].arg]); NEXT;
+ L_END:
+#undef PUT
+#undef DISPATCH
+#undef NEXT
+  g.pc = pc;
+  g.mask = m;
+  return !divided;
+}
+
+// Corre hasta LANES instancias a la vez, con los registros iniciales de
+// inputs; outputs recibe una linea por instancia.
+void Program::sweep(const vector<vector<int> >& inputs, ostream& out) const {
+  int n = code.size();
+  vector<LaneOp> lp(n);
+  for (int i=0; i < n; i++) {
+    lp[i].op = code[i].op;
+    lp[i].h = height[i];
+    lp[i].arg = code[i].arg;
+    lp[i].pad = 0;
+  }
+  int eh = exitheight > 0 ? exitheight : 0;
+  vector<int32_t> stack(LANES * (maxheight > 0 ? maxheight : 1));
+  lanes_t* S = (lanes_t*) stack.data();
+  lanes_t R[8];
+  // resultado de cada instancia al terminar su grupo: r0..r7 y la pila
+  vector<int> result(LANES * (8 + eh));
+  for (int first=0; first < inputs.size(); first += LANES) {
+    int count = min(LANES, (int) inputs.size() - first);
+    int failed[LANES];
+    LaneGroup g;
+    g.pc = 0;
+    g.mask = (lanes_t) {};
+    for (int k=0; k < LANES; k++) {
+      failed[k] = -1;
+      if (k < count) g.mask[k] = -1;
+    }
+    for (int r=0; r < 8; r++) {
+      R[r] = (lanes_t) {};
+      for (int k=0; k < count; k++)
+	if (r < inputs[first+k].size()) R[r][k] = inputs[first+k][r];
+    }
+    fill(stack.begin(), stack.end(), 0);
+    vector<LaneGroup> groups(1, g);
+    while (!groups.empty()) {
+      // el grupo de menor pc avanza hasta alcanzar al siguiente
+      int cur = 0;
+      for (int j=1; j < groups.size(); j++)
+	if (groups[j].pc < groups[cur].pc) cur = j;
+      int limit = n;
+      for (int j=0; j < groups.size(); j++)
+	if (j != cur && groups[j].pc < limit) limit = groups[j].pc;
+      if (limit == groups[cur].pc && limit < n) { // se juntan
+	for (int j=groups.size()-1; j >= 0; j--)
+	  if (j != cur && groups[j].pc == limit) {
+	    groups[cur].mask |= groups[j].mask;
+	    groups.erase(groups.begin() + j);
+	    if (j < cur) cur--;
+	  }
+	continue;
+      }
+      LaneGroup split;
+      bool whole = groups.size() == 1
+	? runGroup<false>(lp.data(), S, R, groups[cur], limit, split, failed)
+	: runGroup<true>(lp.data(), S, R, groups[cur], limit, split, failed);
+      LaneGroup& gc = groups[cur];
+      if (gc.pc >= n)
+	for (int k=0; k < LANES; k++) {
+	  if (!gc.mask[k]) continue;
+	  int* res = &result[k * (8 + eh)];
+	  for (int r=0; r < 8; r++) res[r] = R[r][k];
+	  for (int s=0; s < eh; s++) res[8+s] = S[s][k];
+	}
+      bool done = gc.pc >= n || none(gc.mask);
+      if (done)
+	groups.erase(groups.begin() + cur);
+      if (!whole)
+	groups.push_back(split);
+    }
+    for (int k=0; k < count; k++) {
+      if (failed[k] >= 0) {
+	out << "error: Division by zero (instruction " << failed[k] << ")" << endl;
+	continue;
+      }
+      const int* res = &result[k * (8 + eh)];
+      for (int j=0; j < 8 + eh; j++)
+	out << (j > 0 ? "," : "") << res[j];
+      out << endl;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+
+#include "svm.hh"
+#include "svm_trace.hh"
+
+/* ******** Traza de ejecucion *********** */
+
+TraceBuffer::TraceBuffer(int n):head(0) {
+  uint32_t size = 1;
+  while (size < (uint32_t) n && size < (1u << 30)) size <<= 1;
+  buf = new TraceRecord[size];
+  memset(buf, 0, size * sizeof(TraceRecord));
+  mask = size - 1;
+}
+
+TraceBuffer::~TraceBuffer() {
+  delete [] buf;
+}
+
+// Formato sin asignar memoria (sirve dentro de un manejador de senal)
+static void put(int fd, const char* s) {
+  ssize_t r = write(fd, s, strlen(s));
+  (void) r;
+}
+
+static void putnum(int fd, int64_t v) {
+  char tmp[24];
+  int i = sizeof(tmp);
+  tmp[--i] = '\0';
+  bool neg = v < 0;
+  uint64_t u = neg ? -(uint64_t) v : v;
+  do {
+    tmp[--i] = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+  if (neg) tmp[--i] = '-';
+  put(fd, tmp + i);
+}
+
+void TraceBuffer::dump(int fd) const {
+  uint64_t h = head.load(memory_order_acquire);
+  uint64_t n = h < (uint64_t) size() ? h : size();
+  put(fd, "trace: last ");
+  putnum(fd, n);
+  put(fd, " of ");
+  putnum(fd, h);
+  put(fd, " instructions (pc, instruction, top of stack)\n");
+  for (uint64_t k = h - n; k < h; k++) {
+    const TraceRecord& r = buf[k & mask];
+    put(fd, "  ");
+    putnum(fd, r.pc);
+    put(fd, "\t");
+    put(fd, (r.op >= 0 && r.op < NUM_OPS) ? snames[r.op].c_str() : "?");
+    put(fd, "\t");
+    putnum(fd, r.tos);
+    put(fd, "\n");
+  }
+}
+
+static TraceBuffer* active = NULL;
+
+static void onSignal(int sig) {
+  if (active != NULL) {
+    put(2, "signal ");
+    putnum(2, sig);
+    put(2, "\n");
+    active->dump(2);
+  }
+  if (sig == SIGUSR1) return;
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+void TraceBuffer::installSignals() {
+  active = this;
+  static const int sigs[5] = { SIGFPE, SIGSEGV, SIGINT, SIGTERM, SIGUSR1 };
+  for (int k=0; k < 5; k++) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(sigs[k], &sa, NULL);
+  }
+}
+
+void ExecutionContext::set_trace(TraceBuffer* t) {
+  trace = t;
+}
@@ -0,0 +1,46 @@
+#ifndef SVM_TRACE
+#define SVM_TRACE
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+
+struct TraceRecord {
+  int32_t pc;
+  int32_t op;
+  int32_t tos; // tope de la pila antes de ejecutar la instruccion
+};
+
+// Buffer circular de tamano fijo con las ultimas instrucciones ejecutadas.
+// Lo escribe solo el hilo del SVM: cada registro se completa antes de
+// publicar el nuevo head, asi que un lector (un manejador de senal o
+// perror) ve siempre registros completos sin usar locks.
+class TraceBuffer {
+  TraceRecord* buf;
+  uint32_t mask;
+  atomic<uint64_t> head; // registros escritos desde el inicio
+public:
+  static const int DEFAULT_SIZE = 4096;
+  TraceBuffer(int n = DEFAULT_SIZE);
+  ~TraceBuffer();
+  void record(int pc, int op, int tos) {
+    uint64_t h = head.load(memory_order_relaxed);
+    TraceRecord& r = buf[h & mask];
+    r.pc = pc;
+    r.op = op;
+    r.tos = tos;
+    head.store(h+1, memory_order_release);
+  }
+  int size() const { return mask + 1; }
+  // Escribe los ultimos registros en fd. Solo usa write(2), asi que se
+  // puede llamar desde un manejador de senal.
+  void dump(int fd) const;
+  // Vuelca este buffer en stderr al recibir SIGFPE, SIGSEGV, SIGINT,
+  // SIGTERM (y termina) o SIGUSR1 (y continua).
+  void installSignals();
+};
+
+
+#endif
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Pruebas de regresion del SVM. Cada prueba es tests/NOMBRE.svm (o .svbc),
+# con opciones en NOMBRE.args (una por linea) y la salida esperada en
+# NOMBRE.out. Se corre desde tarea02:
+#   tests/run.sh [./svm]
+svm=${1:-./svm}
+fail=0
+for prog in tests/*.svm tests/*.svbc; do
+  name=${prog%.*}
+  [ -f "$name.out" ] || continue
+  args=""
+  [ -f "$name.args" ] && args=$(cat "$name.args")
+  # timeout: una regresion que no termina tambien es una falla
+  if timeout 20 "$svm" $args "$prog" > "$name.result" 2>&1 && cmp -s "$name.out" "$name.result"; then
+    rm -f "$name.result"
+  else
+    echo "FAIL $name (salida en $name.result)"
+    fail=1
+  fi
+done
+# -O --cache y despues -O --cache --sweep sobre el mismo archivo: la imagen
+# del primero (registros muertos al salir) no sirve para el sweep
+cache=$(mktemp -d)
+"$svm" -O --cache="$cache" tests/sweep_optimize.svm > /dev/null 2>&1
+"$svm" -O --cache="$cache" --sweep=tests/sweep_optimize.csv tests/sweep_optimize.svm 2>&1 |
+  grep -v "^Stored in cache \|^Loaded from cache " > tests/cache_sweep.result
+if cmp -s tests/sweep_optimize.out tests/cache_sweep.result; then
+  rm -f tests/cache_sweep.result
+else
+  echo "FAIL cache_sweep (salida en tests/cache_sweep.result)"
+  fail=1
+fi
+rm -rf "$cache"
+# --svm2c --cc: el binario generado termina igual que el SVM en una
+# division por cero (salida esperada en svm2c_div_zero.out)
+if command -v cc > /dev/null; then
+  tmp=$(mktemp -d)
+  "$svm" --svm2c="$tmp/p.c" --cc="$tmp/p" tests/div_zero_jit.svm > /dev/null 2>&1
+  { "$tmp/p"; echo "exit $?"; } > tests/svm2c_div_zero.result 2>&1
+  if cmp -s tests/svm2c_div_zero.out tests/svm2c_div_zero.result; then
+    rm -f tests/svm2c_div_zero.result
+  else
+    echo "FAIL svm2c_div_zero (salida en tests/svm2c_div_zero.result)"
+    fail=1
+  fi
+  rm -rf "$tmp"
+fi
+[ $fail = 0 ] && echo "OK"
+exit $fail